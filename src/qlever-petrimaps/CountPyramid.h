@@ -0,0 +1,397 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#ifndef PETRIMAPS_COUNTPYRAMID_H_
+#define PETRIMAPS_COUNTPYRAMID_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "qlever-petrimaps/Grid.h"
+#include "qlever-petrimaps/Misc.h"
+#include "util/geo/Geo.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_thread_num() 0
+#endif
+
+namespace petrimaps {
+
+struct CountCell {
+  uint32_t x;
+  uint32_t count;
+};
+
+// the number of values per cell of a raster, only non-empty cells are kept
+class CountLevel {
+ public:
+  double getCellSize() const { return _cellSize; }
+  size_t getXWidth() const { return _xWidth; }
+  size_t getYHeight() const { return _yHeight; }
+  const util::geo::FPoint& getOrigin() const { return _origin; }
+
+  size_t getCellXFromX(double x) const {
+    double dist = x - _origin.getX();
+    if (dist < 0) return 0;
+    return dist / _cellSize;
+  }
+
+  size_t getCellYFromY(double y) const {
+    double dist = y - _origin.getY();
+    if (dist < 0) return 0;
+    return dist / _cellSize;
+  }
+
+  // call f(x, count) for the non-empty cells x0 to x1 of row y
+  template <typename F>
+  void getRow(size_t y, size_t x0, size_t x1, F f) const {
+    if (y >= _yHeight) return;
+    auto end = _cells.begin() + _rows[y + 1];
+    auto it = std::lower_bound(
+        _cells.begin() + _rows[y], end, x0,
+        [](const CountCell& c, size_t x) { return c.x < x; });
+    for (; it != end && it->x <= x1; it++) f(it->x, it->count);
+  }
+
+  size_t bytes() const {
+    return _rows.capacity() * sizeof(size_t) +
+           _cells.capacity() * sizeof(CountCell);
+  }
+
+ private:
+  friend class CountPyramid;
+
+  double _cellSize;
+  size_t _xWidth;
+  size_t _yHeight;
+  util::geo::FPoint _origin;
+
+  // row y holds the cells from _rows[y] to _rows[y + 1], ordered by x
+  std::vector<size_t> _rows;
+  std::vector<CountCell> _cells;
+};
+
+// Levels of count rasters over the values of a grid, from cells of at least
+// PYRAMID_MIN_CELL_SIZE up to a single cell, each level with twice the cell
+// size of the one before. Levels with more than 1 / PYRAMID_MIN_AGGREGATION
+// cells per value are dropped, reading them would hardly be cheaper than
+// reading the values.
+class CountPyramid {
+ public:
+  CountPyramid() : _memory(0), _charged(0) {}
+  CountPyramid(const CountPyramid&) = delete;
+  CountPyramid(CountPyramid&& o)
+      : _levels(std::move(o._levels)),
+        _memory(o._memory),
+        _charged(o._charged) {
+    o._charged = 0;
+  }
+
+  CountPyramid& operator=(CountPyramid&& o) {
+    clear();
+    _levels = std::move(o._levels);
+    _memory = o._memory;
+    _charged = o._charged;
+    o._charged = 0;
+    return *this;
+  }
+
+  // count the values of the frozen grid, pos(val, cellBox) gives the
+  // position of a value in the cell with bounding box cellBox. The levels
+  // are charged to memory.
+  template <typename V, typename F>
+  CountPyramid(const Grid<V, float>& grid, F pos, MemoryBudget* memory,
+               size_t numThreads);
+
+  ~CountPyramid() { clear(); }
+
+  // the coarsest level with cells no larger than cellSize, 0 if there is
+  // none
+  const CountLevel* getLevel(double cellSize) const {
+    const CountLevel* ret = 0;
+    for (const auto& level : _levels) {
+      if (level.getCellSize() > cellSize) break;
+      ret = &level;
+    }
+    return ret;
+  }
+
+ private:
+  std::vector<CountLevel> _levels;
+
+  MemoryBudget* _memory;
+  size_t _charged;
+
+  void charge(size_t bytes) {
+    if (_memory) _memory->charge(bytes);
+    _charged += bytes;
+  }
+
+  void clear() {
+    if (_memory) _memory->release(_charged);
+    _charged = 0;
+    _levels.clear();
+  }
+
+  template <typename V, typename F>
+  void build(const Grid<V, float>& grid, F pos, size_t numThreads);
+  void buildCoarser(size_t numThreads);
+};
+
+// _____________________________________________________________________________
+template <typename V, typename F>
+CountPyramid::CountPyramid(const Grid<V, float>& grid, F pos,
+                           MemoryBudget* memory, size_t numThreads)
+    : _memory(memory), _charged(0) {
+  // the destructor is not called if the constructor throws
+  try {
+    build(grid, pos, numThreads);
+  } catch (...) {
+    clear();
+    throw;
+  }
+}
+
+// _____________________________________________________________________________
+template <typename V, typename F>
+void CountPyramid::build(const Grid<V, float>& grid, F pos,
+                         size_t numThreads) {
+  if (!grid.getXWidth() || !grid.getYHeight()) return;
+
+  size_t numValues = 0;
+  size_t nonEmpty = 0;
+  for (size_t x = 0; x < grid.getXWidth(); x++) {
+    for (size_t y = 0; y < grid.getYHeight(); y++) {
+      numValues += grid.getCell(x, y).size();
+      nonEmpty += !grid.getCell(x, y).empty();
+    }
+  }
+
+  // start with the finest level which would still be kept if the values
+  // were spread evenly over the non-empty grid cells
+  double cellSize = PYRAMID_MIN_CELL_SIZE;
+  while (cellSize * cellSize * numValues <
+         PYRAMID_MIN_AGGREGATION * nonEmpty * grid.getCellWidth() *
+             grid.getCellHeight()) {
+    cellSize *= 2;
+  }
+
+  CountLevel level;
+  level._cellSize = cellSize;
+  level._origin = grid.getBBox().getLowerLeft();
+  level._xWidth = ceil(grid.getXWidth() * grid.getCellWidth() / cellSize);
+  level._yHeight = ceil(grid.getYHeight() * grid.getCellHeight() / cellSize);
+
+  // if the grid cells are aligned to the cells of the level, the values of
+  // a grid cell are counted in a window of the cells covered by it, all
+  // others are sorted by cell
+  size_t rx = grid.getCellWidth() / cellSize;
+  size_t ry = grid.getCellHeight() / cellSize;
+  bool aligned = rx * cellSize == grid.getCellWidth() &&
+                 ry * cellSize == grid.getCellHeight() && rx * ry <= (1 << 16);
+
+  std::vector<std::vector<uint32_t>> windows(numThreads);
+
+  // count the values of each grid cell separately, as (row, cell) pairs
+  std::vector<std::vector<std::pair<uint32_t, CountCell>>> counts(numThreads);
+  std::exception_ptr ePtr;
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 64)
+  for (size_t i = 0; i < grid.getXWidth() * grid.getYHeight(); i++) {
+    size_t x = i % grid.getXWidth();
+    size_t y = i / grid.getXWidth();
+    auto cell = grid.getCell(x, y);
+    if (cell.empty()) continue;
+
+    try {
+      const auto& cellBox = grid.getBox(x, y);
+      auto& out = counts[omp_get_thread_num()];
+      auto& window = windows[omp_get_thread_num()];
+      if (aligned && window.empty()) window.resize(rx * ry, 0);
+
+      std::vector<uint64_t> keys;
+      size_t x0 = x * rx;
+      size_t y0 = y * ry;
+      size_t inWindow = 0;
+
+      for (const auto& val : cell) {
+        const auto& p = pos(val, cellBox);
+        uint64_t cx =
+            std::min(level._xWidth - 1, level.getCellXFromX(p.getX()));
+        uint64_t cy =
+            std::min(level._yHeight - 1, level.getCellYFromY(p.getY()));
+        if (aligned && cx >= x0 && cx < x0 + rx && cy >= y0 && cy < y0 + ry) {
+          window[(cy - y0) * rx + cx - x0]++;
+          inWindow++;
+        } else {
+          keys.push_back((cy << 32) | cx);
+        }
+      }
+
+      for (size_t k = 0; inWindow > 0 && k < rx * ry; k++) {
+        if (!window[k]) continue;
+        out.push_back({static_cast<uint32_t>(y0 + k / rx),
+                       {static_cast<uint32_t>(x0 + k % rx), window[k]}});
+        inWindow -= window[k];
+        window[k] = 0;
+      }
+
+      std::sort(keys.begin(), keys.end());
+
+      for (size_t k = 0; k < keys.size(); k++) {
+        if (k == 0 || keys[k] != keys[k - 1]) {
+          out.push_back({static_cast<uint32_t>(keys[k] >> 32),
+                         {static_cast<uint32_t>(keys[k]), 0}});
+        }
+        out.back().second.count++;
+      }
+    } catch (...) {
+#pragma omp critical
+      { ePtr = std::current_exception(); }
+    }
+  }
+
+  if (ePtr) std::rethrow_exception(ePtr);
+
+  // distribute the cells over the rows, then order each row by x. A cell
+  // may have been counted for more than one grid cell, because of rounding
+  // at the grid cell borders.
+  size_t numCells = 0;
+  for (const auto& c : counts) numCells += c.size();
+
+  charge((level._yHeight + 1) * sizeof(size_t) +
+         numCells * sizeof(CountCell));
+  level._rows.resize(level._yHeight + 1, 0);
+  level._cells.resize(numCells);
+
+  for (const auto& c : counts) {
+    for (const auto& cell : c) level._rows[cell.first + 1]++;
+  }
+  for (size_t y = 0; y < level._yHeight; y++) {
+    level._rows[y + 1] += level._rows[y];
+  }
+
+  std::vector<size_t> next(level._rows.begin(), level._rows.end() - 1);
+  for (auto& c : counts) {
+    for (const auto& cell : c) level._cells[next[cell.first]++] = cell.second;
+    std::vector<std::pair<uint32_t, CountCell>>().swap(c);
+  }
+
+  std::vector<size_t> unique(level._yHeight, 0);
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 64)
+  for (size_t y = 0; y < level._yHeight; y++) {
+    auto begin = level._cells.begin() + level._rows[y];
+    auto end = level._cells.begin() + level._rows[y + 1];
+    std::sort(begin, end, [](const CountCell& a, const CountCell& b) {
+      return a.x < b.x;
+    });
+    for (auto it = begin; it != end; it++) {
+      if (unique[y] && begin[unique[y] - 1].x == it->x) {
+        begin[unique[y] - 1].count += it->count;
+      } else {
+        begin[unique[y]++] = *it;
+      }
+    }
+  }
+
+  if (std::accumulate(unique.begin(), unique.end(), size_t(0)) < numCells) {
+    size_t n = 0;
+    for (size_t y = 0; y < level._yHeight; y++) {
+      if (n != level._rows[y]) {
+        std::copy(level._cells.begin() + level._rows[y],
+                  level._cells.begin() + level._rows[y] + unique[y],
+                  level._cells.begin() + n);
+      }
+      level._rows[y] = n;
+      n += unique[y];
+    }
+    level._rows.back() = n;
+    level._cells.resize(n);
+  }
+
+  _levels.push_back(std::move(level));
+
+  while (_levels.back().getXWidth() > 1 || _levels.back().getYHeight() > 1) {
+    buildCoarser(numThreads);
+
+    const auto& fine = _levels[_levels.size() - 2];
+    if (fine._cells.size() * PYRAMID_MIN_AGGREGATION > numValues) {
+      if (_memory) _memory->release(fine.bytes());
+      _charged -= fine.bytes();
+      _levels.erase(_levels.end() - 2);
+    }
+  }
+}
+
+// _____________________________________________________________________________
+inline void CountPyramid::buildCoarser(size_t numThreads) {
+  const auto& fine = _levels.back();
+
+  CountLevel level;
+  level._cellSize = fine._cellSize * 2;
+  level._origin = fine._origin;
+  level._xWidth = (fine._xWidth + 1) / 2;
+  level._yHeight = (fine._yHeight + 1) / 2;
+
+  // merge rows 2y and 2y + 1 of the finer level into row y, only counts the
+  // resulting cells if out is 0
+  auto merge = [&fine](size_t y, CountCell* out) {
+    const CountCell* a = fine._cells.data() + fine._rows[2 * y];
+    const CountCell* aEnd = fine._cells.data() + fine._rows[2 * y + 1];
+    const CountCell* b = aEnd;
+    const CountCell* bEnd =
+        fine._cells.data() + fine._rows[std::min(2 * y + 2, fine._yHeight)];
+
+    size_t n = 0;
+    uint32_t lastX = 0;
+    while (a != aEnd || b != bEnd) {
+      const CountCell* c = (b == bEnd || (a != aEnd && a->x <= b->x)) ? a++
+                                                                       : b++;
+      uint32_t x = c->x / 2;
+      if (n == 0 || x != lastX) {
+        if (out) out[n] = {x, 0};
+        lastX = x;
+        n++;
+      }
+      if (out) {
+        out[n - 1].count = std::min<uint64_t>(
+            std::numeric_limits<uint32_t>::max(),
+            static_cast<uint64_t>(out[n - 1].count) + c->count);
+      }
+    }
+    return n;
+  };
+
+  level._rows.resize(level._yHeight + 1, 0);
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 64)
+  for (size_t y = 0; y < level._yHeight; y++) {
+    level._rows[y + 1] = merge(y, 0);
+  }
+
+  for (size_t y = 0; y < level._yHeight; y++) {
+    level._rows[y + 1] += level._rows[y];
+  }
+
+  charge(level.bytes() + level._rows.back() * sizeof(CountCell));
+  level._cells.resize(level._rows.back());
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 64)
+  for (size_t y = 0; y < level._yHeight; y++) {
+    merge(y, level._cells.data() + level._rows[y]);
+  }
+
+  _levels.push_back(std::move(level));
+}
+
+}  // namespace petrimaps
+
+#endif  // PETRIMAPS_COUNTPYRAMID_H_
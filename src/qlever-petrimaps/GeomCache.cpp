@@ -3,18 +3,27 @@
 // Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
 
 #include <curl/curl.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 #include "qlever-petrimaps/GeomCache.h"
 #include "qlever-petrimaps/Misc.h"
+#include "qlever-petrimaps/RadixSort.h"
+#include "qlever-petrimaps/WKT.h"
 #include "qlever-petrimaps/server/Requestor.h"
 #include "util/Misc.h"
 #include "util/geo/Geo.h"
@@ -26,6 +35,18 @@ using util::geo::DPoint;
 using util::geo::FPoint;
 using util::geo::latLngToWebMerc;
 
+// marks a free slot in the geometry dedup table
+const static uint64_t GEOM_SLOT_EMPTY = std::numeric_limits<uint64_t>::max();
+
+// half the width of the web mercator plane
+const static double WEB_MERC_EXT = 20037508.342789244;
+
+// a geometry id and its position on the Hilbert curve
+struct HilbertId {
+  uint32_t key;
+  ID_TYPE id;
+};
+
 const static std::string QUERY =
     "PREFIX geo: <http://www.opengis.net/ont/geosparql#> "
     "SELECT ?geometry WHERE {"
@@ -62,6 +83,105 @@ const static std::string COUNT_QUERY_WD =
     "  ?ob wdt:P625 ?coord"
     "}";
 
+// the MD5 hashes of the rows of the queries above, in the same order
+const static std::string HASH_QUERY =
+    "PREFIX geo: <http://www.opengis.net/ont/geosparql#> "
+    "SELECT (MD5(STR(?geometry)) AS ?hash) WHERE {"
+    " ?osm_id geo:hasGeometry ?geometry "
+    "} INTERNAL SORT BY ?geometry";
+
+const static std::string HASH_QUERY_ASWKT =
+    "PREFIX geo: <http://www.opengis.net/ont/geosparql#> "
+    "SELECT (MD5(STR(?geometry)) AS ?hash) WHERE {"
+    " ?osm_id geo:hasGeometry ?m . ?m geo:asWKT ?geometry "
+    "} INTERNAL SORT BY ?geometry";
+
+const static std::string HASH_QUERY_WD =
+    "PREFIX wdt: <http://www.wikidata.org/prop/direct/> "
+    "SELECT (MD5(STR(?coord)) AS ?hash) WHERE {"
+    "  ?ob wdt:P625 ?coord"
+    "} INTERNAL SORT BY ?coord";
+
+const static uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+const static uint8_t MD5_R[16] = {7, 12, 17, 22, 5, 9,  14, 20,
+                                  4, 11, 16, 23, 6, 10, 15, 21};
+
+// _____________________________________________________________________________
+static void md5Block(const uint8_t *b, uint32_t *st) {
+  uint32_t m[16];
+  for (size_t i = 0; i < 16; i++) {
+    m[i] = b[4 * i] | (b[4 * i + 1] << 8) | (b[4 * i + 2] << 16) |
+           (static_cast<uint32_t>(b[4 * i + 3]) << 24);
+  }
+
+  uint32_t a = st[0], c = st[2], d = st[3], e = st[1];
+  for (size_t i = 0; i < 64; i++) {
+    uint32_t f;
+    size_t g;
+    if (i < 16) {
+      f = (e & c) | (~e & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & e) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = e ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (e | ~d);
+      g = (7 * i) % 16;
+    }
+    f += a + MD5_K[i] + m[g];
+    a = d;
+    d = c;
+    c = e;
+    uint32_t r = MD5_R[(i / 16) * 4 + i % 4];
+    e += (f << r) | (f >> (32 - r));
+  }
+
+  st[0] += a;
+  st[1] += e;
+  st[2] += c;
+  st[3] += d;
+}
+
+// _____________________________________________________________________________
+static void md5(const char *s, size_t size, uint8_t *digest) {
+  // RFC 1321, the same digest as the MD5() of the backend
+  uint32_t st[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    md5Block(reinterpret_cast<const uint8_t *>(s + i), st);
+  }
+
+  // padding, followed by the length in bits
+  uint8_t tail[128] = {0};
+  size_t rest = size - i;
+  memcpy(tail, s + i, rest);
+  tail[rest] = 0x80;
+  size_t tailSize = rest < 56 ? 64 : 128;
+  uint64_t bits = static_cast<uint64_t>(size) * 8;
+  for (size_t j = 0; j < 8; j++) tail[tailSize - 8 + j] = bits >> (8 * j);
+
+  md5Block(tail, st);
+  if (tailSize == 128) md5Block(tail + 64, st);
+
+  for (size_t j = 0; j < 16; j++) digest[j] = st[j / 4] >> (8 * (j % 4));
+}
+
 // Helper function that returns one of the given three query strings based on
 // the `backendUrl`. Used for `getQuery` and `getCountQuery` below.
 // _____________________________________________________________________________
@@ -97,6 +217,13 @@ const std::string &GeomCache::getCountQuery(
                                COUNT_QUERY);
 }
 
+// _____________________________________________________________________________
+const std::string &GeomCache::getHashQuery(
+    const std::string &backendUrl) const {
+  return selectQueryBasedOnUrl(backendUrl, HASH_QUERY_ASWKT, HASH_QUERY_WD,
+                               HASH_QUERY);
+}
+
 // _____________________________________________________________________________
 size_t GeomCache::writeCbString(void *contents, size_t size, size_t nmemb,
                                 void *userp) {
@@ -108,11 +235,11 @@ size_t GeomCache::writeCbString(void *contents, size_t size, size_t nmemb,
 size_t GeomCache::writeCb(void *contents, size_t size, size_t nmemb,
                           void *userp) {
   size_t realsize = size * nmemb;
+  auto part = static_cast<FillPart *>(userp);
   try {
-    static_cast<GeomCache *>(userp)->parse(static_cast<const char *>(contents),
-                                           realsize);
+    part->cache->parse(part, static_cast<const char *>(contents), realsize);
   } catch (...) {
-    static_cast<GeomCache *>(userp)->_exceptionPtr = std::current_exception();
+    part->exceptionPtr = std::current_exception();
     return CURLE_WRITE_ERROR;
   }
   return realsize;
@@ -147,228 +274,888 @@ size_t GeomCache::writeCbCount(void *contents, size_t size, size_t nmemb,
 }
 
 // _____________________________________________________________________________
-void GeomCache::parse(const char *c, size_t size) {
+static const char *rowBegin(const char *begin, const char *rowEnd) {
+  // rowEnd is the newline of the row
+  while (rowEnd > begin && rowEnd[-1] != '\n') rowEnd--;
+  return rowEnd;
+}
+
+// _____________________________________________________________________________
+static const char *lastRun(const char *begin, const char *end) {
+  // the start of the last run of identical rows in [begin, end), which ends
+  // with a newline
+  if (begin == end) return begin;
+
+  const char *rowEnd = end - 1;
+  const char *rowStart = rowBegin(begin, rowEnd);
+
+  while (rowStart > begin) {
+    const char *prevEnd = rowStart - 1;
+    const char *prevStart = rowBegin(begin, prevEnd);
+
+    if (prevEnd - prevStart != rowEnd - rowStart ||
+        strncasecmp(prevStart, rowStart, rowEnd - rowStart) != 0) {
+      return rowStart;
+    }
+
+    rowStart = prevStart;
+    rowEnd = prevEnd;
+  }
+
+  return begin;
+}
+
+// _____________________________________________________________________________
+void GeomCache::parse(FillPart *part, const char *c, size_t size) {
   _loadStatusStage = _LoadStatusStages::Parse;
 
-  const char *start = c;
-  while (c < start + size) {
-    if (_raw.size() < 10000) _raw.push_back(*c);
-    switch (_state) {
-      case IN_HEADER:
-        if (*c == '\n') {
-          _state = IN_ROW;
-          c++;
+  if (part->raw.size() < 10000) {
+    part->raw.append(c, std::min(size, 10000 - part->raw.size()));
+  }
+
+  const char *end = c + size;
+  std::string &dangling = part->dangling;
+
+  if (part->state == IN_HEADER) {
+    auto n = static_cast<const char *>(memchr(c, '\n', size));
+    if (!n) return;
+    part->state = IN_ROW;
+    c = n + 1;
+  }
+
+  if (part->hashes) {
+    // only the fingerprints of the rows are kept, a row is only copied if it
+    // straddles two buffers
+    auto addRow = [this, part](const char *row, size_t len) {
+      uint64_t hash;
+      uint32_t check;
+      part->known.push_back(hexFingerprint(row, len, &hash, &check)
+                                ? refreshFingerprint(hash, check)
+                                : FINGERPRINT_NONE);
+    };
+
+    const char *n;
+    if (!dangling.empty()) {
+      n = static_cast<const char *>(memchr(c, '\n', end - c));
+      if (!n) {
+        dangling.append(c, end - c);
+        return;
+      }
+      dangling.append(c, n - c);
+      addRow(dangling.data(), dangling.size());
+      c = n + 1;
+    }
+
+    while ((n = static_cast<const char *>(memchr(c, '\n', end - c)))) {
+      addRow(c, n - c);
+      c = n + 1;
+    }
+    dangling.assign(c, end - c);
+    return;
+  }
+
+  part->numRows += std::count(c, end, '\n');
+
+  // complete the row that straddles the previous buffer, and take along the
+  // rows identical to it, so that the collected rows form a batch of their
+  // own
+  const char *b = c;
+  if (!dangling.empty()) {
+    if (dangling.back() != '\n') {
+      auto n = static_cast<const char *>(memchr(c, '\n', end - c));
+      if (!n) {
+        dangling.append(c, end - c);
+        return;
+      }
+      dangling.append(c, n + 1 - c);
+      b = n + 1;
+    }
+
+    const char *d = dangling.data();
+    const char *row = rowBegin(d, d + dangling.size() - 1);
+    size_t len = d + dangling.size() - row;
+    const char *e = b;
+    while (static_cast<size_t>(end - e) >= len &&
+           strncasecmp(e, row, len) == 0) {
+      e += len;
+    }
+    dangling.append(b, e - b);
+    b = e;
+  }
+
+  // the complete rows after b are parsed in place, except for the last run
+  // of identical rows, which is copied along with the incomplete row
+  const char *last = end;
+  while (last > b && last[-1] != '\n') last--;
+  const char *cut = lastRun(b, last);
+
+  if (cut == b) {
+    dangling.append(b, end - b);
+    if (dangling.size() >= PARSE_BATCH_SIZE) queueParseBatch(part, false);
+    return;
+  }
+
+  parseInPlace(part, b, cut);
+  dangling.assign(cut, end - cut);
+}
+
+// _____________________________________________________________________________
+void GeomCache::queueParseBatch(FillPart *part, bool last) {
+  std::string &dangling = part->dangling;
+  size_t cut = dangling.rfind('\n');
+  if (cut == std::string::npos) return;
+  cut++;
+
+  if (!last) {
+    // never cut between two identical rows, so that the re-use of the
+    // previous row's geometry can always be decided inside a single batch.
+    // As the row following the cut must be complete, the last complete row
+    // always stays in the buffer.
+    const char *d = dangling.data();
+    cut = lastRun(d, d + cut) - d;
+    if (cut == 0) return;
+  }
+
+  // hand the buffer over to the batch, only the rows after the cut (which
+  // continue in the next callback) are copied
+  ParseBatch batch;
+  batch.rows.swap(dangling);
+  if (!last) dangling.reserve(PARSE_BATCH_SIZE + CURL_MAX_WRITE_SIZE);
+  dangling.assign(batch.rows, cut, std::string::npos);
+  batch.rows.resize(cut);
+
+  std::unique_lock<std::mutex> lock(_parseM);
+
+  // limit the number of raw batches waiting for a worker
+  _parsedCv.wait(lock, [this] {
+    return _parseQueue.size() < 2 * _parseThreads.size() || _parseExceptionPtr;
+  });
+  if (_parseExceptionPtr) std::rethrow_exception(_parseExceptionPtr);
+
+  batch.part = part->part;
+  batch.seq = part->numBatches++;
+  _parseQueue.push_back(std::move(batch));
+  _parseCv.notify_one();
+}
+
+// _____________________________________________________________________________
+void GeomCache::parseInPlace(FillPart *part, const char *begin,
+                             const char *end) {
+  std::vector<ParseBatch> batches;
+
+  // the rows collected from previous buffers come first
+  bool collected = !part->dangling.empty();
+  if (collected) {
+    batches.push_back(ParseBatch());
+    batches.back().rows.swap(part->dangling);
+  }
+
+  // about one batch per parse worker, again never cut between two identical
+  // rows
+  size_t size = std::max(PARSE_MIN_BATCH_SIZE,
+                         (end - begin) / _parseThreads.size() + 1);
+
+  while (begin < end) {
+    const char *cut = begin;
+    const char *n = begin + size - 1;
+    while (cut == begin && n + 1 < end) {
+      n = static_cast<const char *>(memchr(n + 1, '\n', end - n - 1));
+      cut = lastRun(begin, n + 1);
+    }
+    if (cut == begin) cut = end;
+
+    ParseBatch batch;
+    batch.begin = begin;
+    batch.end = cut;
+    batches.push_back(std::move(batch));
+    begin = cut;
+  }
+
+  for (auto &batch : batches) {
+    batch.part = part->part;
+    batch.seq = part->numBatches++;
+  }
+
+  // the collected rows and the last batch are parsed by this thread, the
+  // others by the parse workers
+  {
+    std::lock_guard<std::mutex> lock(_parseM);
+    if (_parseExceptionPtr) std::rethrow_exception(_parseExceptionPtr);
+    for (size_t i = collected; i + 1 < batches.size(); i++) {
+      _parseQueue.push_back(std::move(batches[i]));
+      _inPlaceBatches++;
+    }
+  }
+  _parseCv.notify_all();
+
+  std::exception_ptr exceptionPtr;
+  try {
+    if (collected) parseBatch(&batches.front());
+    if (batches.size() > 1 || !collected) parseBatch(&batches.back());
+  } catch (...) {
+    exceptionPtr = std::current_exception();
+  }
+
+  {
+    // the buffer is only valid until the write callback returns
+    std::unique_lock<std::mutex> lock(_parseM);
+    _parsedCv.wait(lock, [this] { return _inPlaceBatches == 0; });
+    if (exceptionPtr) _parseExceptionPtr = exceptionPtr;
+    if (_parseExceptionPtr) std::rethrow_exception(_parseExceptionPtr);
+
+    if (collected) {
+      auto &batch = batches.front();
+      _parsed[std::make_pair(batch.part, batch.seq)] = std::move(batch);
+    }
+    if (batches.size() > 1 || !collected) {
+      auto &batch = batches.back();
+      batch.begin = batch.end = 0;
+      _parsed[std::make_pair(batch.part, batch.seq)] = std::move(batch);
+    }
+  }
+
+  stitchParsed();
+}
+
+// _____________________________________________________________________________
+void GeomCache::startParseWorkers() {
+  _parseQueue.clear();
+  _parsed.clear();
+  _partBatches.clear();
+  _partRows.clear();
+  _stitchPart = 0;
+  _stitchSeq = 0;
+  _parseDone = false;
+  _parseExceptionPtr = 0;
+
+  size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t i = 0; i < numThreads; i++) {
+    _parseThreads.push_back(std::thread(&GeomCache::parseWorker, this));
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::stopParseWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(_parseM);
+    _parseQueue.clear();
+    _parseDone = true;
+  }
+  _parseCv.notify_all();
+
+  for (auto &t : _parseThreads) t.join();
+  _parseThreads.clear();
+}
+
+// _____________________________________________________________________________
+void GeomCache::parseWorker() {
+  while (true) {
+    ParseBatch batch;
+    {
+      std::unique_lock<std::mutex> lock(_parseM);
+      _parseCv.wait(lock,
+                    [this] { return !_parseQueue.empty() || _parseDone; });
+      if (_parseQueue.empty()) return;
+      batch = std::move(_parseQueue.front());
+      _parseQueue.pop_front();
+    }
+    _parsedCv.notify_all();
+
+    std::exception_ptr exceptionPtr;
+    try {
+      parseBatch(&batch);
+    } catch (...) {
+      exceptionPtr = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_parseM);
+
+      // rows parsed in place must not be touched after their write callback
+      // has returned
+      if (batch.end) {
+        batch.begin = batch.end = 0;
+        _inPlaceBatches--;
+      }
+
+      if (exceptionPtr) {
+        _parseExceptionPtr = exceptionPtr;
+      } else {
+        auto key = std::make_pair(batch.part, batch.seq);
+        _parsed[key] = std::move(batch);
+      }
+    }
+    _parsedCv.notify_all();
+
+    if (!exceptionPtr) stitchParsed();
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::stitchParsed() {
+  while (true) {
+    // only one thread stitches at a time, the others just leave their
+    // batches in _parsed
+    std::unique_lock<std::mutex> stitchLock(_stitchM, std::try_to_lock);
+    if (!stitchLock.owns_lock()) return;
+
+    while (true) {
+      ParseBatch batch;
+      {
+        std::lock_guard<std::mutex> lock(_parseM);
+        if (partStitched()) {
+          // continue with the first batch of the next window
+          _stitchPart++;
+          _stitchSeq = 0;
+          _parsedCv.notify_all();
           continue;
+        }
+        auto it = _parsed.find(std::make_pair(_stitchPart, _stitchSeq));
+        if (it == _parsed.end()) break;
+        batch = std::move(it->second);
+        _parsed.erase(it);
+      }
+
+      stitchBatch(&batch);
+
+      {
+        std::lock_guard<std::mutex> lock(_parseM);
+        _partRows[batch.part] += batch.numRows;
+        _stitchSeq++;
+      }
+      _parsedCv.notify_all();
+    }
+
+    stitchLock.unlock();
+
+    // the next batch may have been finished while we were still holding the
+    // stitch lock
+    std::lock_guard<std::mutex> lock(_parseM);
+    if (!partStitched() &&
+        !_parsed.count(std::make_pair(_stitchPart, _stitchSeq)))
+      return;
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::stitchBatch(ParseBatch *batch) {
+  // global ids of the batch's points and lines, geometries which are already
+  // stored are re-used
+  std::vector<ID_TYPE> pointIds(batch->points.size());
+  std::vector<ID_TYPE> lineIds(batch->lines.size());
+
+  for (size_t i = 0; i < batch->points.size(); i++) {
+    const auto &p = batch->points[i];
+    size_t slot = geomSlot(batch->pointHashes[i], &p, sizeof(p));
+
+    if (_geomSlots[slot] != GEOM_SLOT_EMPTY) {
+      pointIds[i] = static_cast<ID_TYPE>(_geomSlots[slot]);
+      _dedupGeoms++;
+      _dedupBytes += sizeof(p);
+      continue;
+    }
+
+    pointIds[i] = _points.size();
+    _points.push_back(p);
+    insertGeomSlot(slot, batch->pointHashes[i], pointIds[i]);
+  }
+
+  for (size_t i = 0; i < batch->lines.size(); i++) {
+    size_t start = batch->lines[i];
+    size_t end = i + 1 < batch->lines.size() ? batch->lines[i + 1]
+                                             : batch->linePoints.size();
+    const auto *l = &batch->linePoints[start];
+    size_t bytes = (end - start) * sizeof(util::geo::Point<int16_t>);
+    size_t slot = geomSlot(batch->lineHashes[i], l, bytes);
+
+    if (_geomSlots[slot] != GEOM_SLOT_EMPTY) {
+      lineIds[i] = static_cast<ID_TYPE>(_geomSlots[slot]) - I_OFFSET;
+      _dedupGeoms++;
+      _dedupBytes += bytes + sizeof(size_t);
+      continue;
+    }
+
+    lineIds[i] = _lines.size();
+    _lines.push_back(_linePoints.size());
+    _linePoints.append(l, end - start);
+    insertGeomSlot(slot, batch->lineHashes[i], I_OFFSET + lineIds[i]);
+  }
+
+  for (auto &idm : batch->qidToId) {
+    if (idm.id == std::numeric_limits<ID_TYPE>::max()) continue;
+    if (idm.id >= I_OFFSET)
+      idm.id = I_OFFSET + lineIds[idm.id - I_OFFSET];
+    else
+      idm.id = pointIds[idm.id];
+  }
+  _qidToId.append(batch->qidToId.data(), batch->qidToId.size());
+
+  addFingerprints(*batch);
+  _refreshedGeoms += batch->refreshedGeoms;
+
+  size_t prevRow = _curRow;
+  _curRow += batch->numRows;
+  _curUniqueGeom += batch->uniqueGeoms;
+
+  if (prevRow / 1000000 != _curRow / 1000000) {
+    LOG(INFO) << "[GEOMCACHE] "
+              << "@ row " << _curRow << " (" << std::fixed
+              << std::setprecision(2) << getLoadStatusPercent() << "%, "
+              << _points.size() << " points, " << _lines.size()
+              << " (open) polygons, " << _geometryDuplicates << " duplicates)";
+  }
+}
+
+// _____________________________________________________________________________
+uint32_t GeomCache::geomHash(const void *data, size_t size) {
+  const char *c = static_cast<const char *>(data);
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ size;
+
+  for (; size >= 8; size -= 8, c += 8) {
+    uint64_t w;
+    memcpy(&w, c, 8);
+    h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+  }
+
+  uint64_t w = 0;
+  memcpy(&w, c, size);
+  h = (h ^ w) * 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 29;
+
+  return h >> 32;
+}
+
+// _____________________________________________________________________________
+void GeomCache::wktFingerprint(const char *s, size_t size, uint64_t *hash,
+                               uint32_t *check) {
+  // the lexical form of the literal, as hashed by MD5(STR(?geometry)) on
+  // the backend
+  if (size >= 2 && *s == '"') {
+    auto q = static_cast<const char *>(memrchr(s + 1, '"', size - 1));
+    if (q) {
+      size = q - s - 1;
+      s++;
+    }
+  }
+
+  uint8_t d[16];
+  md5(s, size, d);
+
+  *hash = 0;
+  *check = 0;
+  for (size_t i = 0; i < 8; i++) *hash = (*hash << 8) | d[i];
+  for (size_t i = 8; i < 12; i++) *check = (*check << 8) | d[i];
+}
+
+// _____________________________________________________________________________
+bool GeomCache::hexFingerprint(const char *s, size_t size, uint64_t *hash,
+                               uint32_t *check) {
+  // a cell of the hash query, the hex digest, possibly quoted
+  if (size > 0 && *s == '"') {
+    s++;
+    size--;
+  }
+  if (size < 24) return false;
+
+  *hash = 0;
+  *check = 0;
+  for (size_t i = 0; i < 24; i++) {
+    uint32_t v;
+    if (s[i] >= '0' && s[i] <= '9') {
+      v = s[i] - '0';
+    } else if (s[i] >= 'a' && s[i] <= 'f') {
+      v = s[i] - 'a' + 10;
+    } else if (s[i] >= 'A' && s[i] <= 'F') {
+      v = s[i] - 'A' + 10;
+    } else {
+      return false;
+    }
+
+    if (i < 16) {
+      *hash = (*hash << 4) | v;
+    } else {
+      *check = (*check << 4) | v;
+    }
+  }
+
+  return true;
+}
+
+// _____________________________________________________________________________
+size_t GeomCache::refreshFingerprint(uint64_t hash, uint32_t check) const {
+  if (_refreshFingerprints.empty()) return FINGERPRINT_NONE;
+
+  GeomFingerprint key{hash, check, 0, 0};
+  auto it = std::lower_bound(_refreshFingerprints.begin(),
+                             _refreshFingerprints.end(), key);
+  if (it == _refreshFingerprints.end() || it->hash != hash ||
+      it->check != check)
+    return FINGERPRINT_NONE;
+
+  return it - _refreshFingerprints.begin();
+}
+
+// _____________________________________________________________________________
+void GeomCache::refreshGeoms(size_t fp, IdMapping *lastQidToId,
+                             ParseBatch *batch) const {
+  const auto &f = _refreshFingerprints[fp];
+
+  // copy the already encoded geometries of the previous fill, with the same
+  // multi geometry continuation ids the parser would have produced
+  for (size_t i = 0; i < f.num; i++) {
+    ID_TYPE id = _refreshFingerprintIds[f.ids + i];
+    IdMapping idm{i == 0 ? 0 : 1, std::numeric_limits<ID_TYPE>::max()};
+
+    if (id == std::numeric_limits<ID_TYPE>::max()) {
+      // invalid geometry
+    } else if (id >= I_OFFSET) {
+      size_t lid = id - I_OFFSET;
+      size_t start = _refreshLines[lid];
+      size_t end = lid + 1 < _refreshLines.size() ? _refreshLines[lid + 1]
+                                                  : _refreshLinePoints.size();
+      batch->lines.push_back(batch->linePoints.size());
+      batch->linePoints.insert(batch->linePoints.end(),
+                               _refreshLinePoints.begin() + start,
+                               _refreshLinePoints.begin() + end);
+      idm.id = I_OFFSET + batch->lines.size() - 1;
+    } else {
+      batch->points.push_back(_refreshPoints[id]);
+      idm.id = batch->points.size() - 1;
+    }
+
+    *lastQidToId = idm;
+    batch->qidToId.push_back(idm);
+  }
+
+  batch->refreshedGeoms++;
+}
+
+// _____________________________________________________________________________
+void GeomCache::addFingerprints(const ParseBatch &batch) {
+  // called after the ids of the batch have been made global
+  // rows without any valid geometry are kept too, so that a refresh does
+  // not fetch them again
+  for (const auto &fp : batch.rowFingerprints) {
+    size_t end = fp.qidIdx + 1;
+    while (end < batch.qidToId.size() && batch.qidToId[end].qid == 1) end++;
+
+    GeomFingerprint g{fp.hash, fp.check,
+                      static_cast<uint32_t>(end - fp.qidIdx),
+                      _fingerprintIds.size()};
+    for (size_t i = fp.qidIdx; i < end; i++) {
+      _fingerprintIds.push_back(batch.qidToId[i].id);
+    }
+    _fingerprints.push_back(g);
+  }
+}
+
+// _____________________________________________________________________________
+size_t GeomCache::geomSlot(uint32_t hash, const void *data, size_t size) const {
+  // linear probing, the slot position is derived from the hash only, so the
+  // table can grow without access to the full fingerprints
+  size_t n = _geomSlots.size();
+  size_t i = (static_cast<uint64_t>(hash) * n) >> 32;
+
+  while (true) {
+    uint64_t slot = _geomSlots[i];
+    if (slot == GEOM_SLOT_EMPTY) return i;
+
+    if ((slot >> 32) == hash) {
+      ID_TYPE id = static_cast<ID_TYPE>(slot);
+      if (id < I_OFFSET) {
+        if (size == sizeof(util::geo::FPoint) &&
+            memcmp(&_points[id], data, size) == 0)
+          return i;
+      } else {
+        id -= I_OFFSET;
+        size_t start = _lines[id];
+        size_t end =
+            id + 1 < _lines.size() ? _lines[id + 1] : _linePoints.size();
+        if ((end - start) * sizeof(util::geo::Point<int16_t>) == size &&
+            memcmp(&_linePoints[start], data, size) == 0)
+          return i;
+      }
+    }
+
+    i = (i + 1) % n;
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::insertGeomSlot(size_t slot, uint32_t hash, ID_TYPE id) {
+  _geomSlots[slot] = (static_cast<uint64_t>(hash) << 32) | id;
+  _numGeomSlots++;
+
+  if (_numGeomSlots * 10 < _geomSlots.size() * 7) return;
+
+  // grow the table
+  std::vector<uint64_t> old(_geomSlots.size() * 2, GEOM_SLOT_EMPTY);
+  old.swap(_geomSlots);
+
+  size_t n = _geomSlots.size();
+  for (uint64_t s : old) {
+    if (s == GEOM_SLOT_EMPTY) continue;
+    size_t i = ((s >> 32) * n) >> 32;
+    while (_geomSlots[i] != GEOM_SLOT_EMPTY) i = (i + 1) % n;
+    _geomSlots[i] = s;
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::parseBatch(ParseBatch *batch) const {
+  IdMapping lastQidToId{std::numeric_limits<QLEVER_ID_TYPE>::max(),
+                        std::numeric_limits<ID_TYPE>::max()};
+
+  // the previous cell, cells are never copied out of the batch
+  const char *prev = 0;
+  size_t prevLen = 0;
+
+  // without a cache dir, the fingerprints are only needed for a refresh
+  bool fingerprint = _keepFingerprints || !_refreshFingerprints.empty();
+
+  const char *c = batch->end ? batch->begin : batch->rows.c_str();
+  const char *end = batch->end ? batch->end : c + batch->rows.size();
+
+  while (c < end) {
+    const char *rowEnd = static_cast<const char *>(memchr(c, '\n', end - c));
+    if (!rowEnd) break;
+
+    while (true) {
+      const char *cellEnd =
+          static_cast<const char *>(memchr(c, '\t', rowEnd - c));
+      if (!cellEnd) cellEnd = rowEnd;
+
+      // bool isGeom = util::endsWith(
+      // dangling, "^^<http://www.opengis.net/ont/geosparql#wktLiteral>");
+
+      bool isGeom = true;
+
+      size_t len = cellEnd - c;
+      const char *p;
+
+      // if the previous was not a multi geometry, and if the strings
+      // match exactly, re-use the geometry
+      bool samePrev = isGeom && prev && prevLen == len &&
+                      lastQidToId.qid == 0 && strncasecmp(prev, c, len) == 0;
+
+      uint64_t hash = 0;
+      uint32_t check = 0;
+      size_t fp = FINGERPRINT_NONE;
+      size_t qidIdx = batch->qidToId.size();
+      if (!samePrev && *c == '#') {
+        // a row of a refresh whose fingerprint was fetched instead of its
+        // WKT
+        fp = 0;
+        for (const char *d = c + 1; d < cellEnd; d++) fp = fp * 10 + *d - '0';
+        if (fp >= _refreshFingerprints.size()) {
+          throw std::runtime_error("Invalid fingerprint in refresh");
+        }
+      } else if (!samePrev && fingerprint) {
+        wktFingerprint(c, len, &hash, &check);
+        fp = refreshFingerprint(hash, check);
+      }
+
+      if (fp != FINGERPRINT_NONE) {
+        hash = _refreshFingerprints[fp].hash;
+        check = _refreshFingerprints[fp].check;
+      }
+
+      if (samePrev) {
+        IdMapping idm{0, lastQidToId.id};
+        lastQidToId = idm;
+        batch->qidToId.push_back(idm);
+      } else if (isGeom && fp != FINGERPRINT_NONE) {
+        refreshGeoms(fp, &lastQidToId, batch);
+        batch->uniqueGeoms++;
+      } else if (isGeom && (p = wktPrefix(c, cellEnd, "\"POINT("))) {
+        batch->uniqueGeoms++;
+        auto point = parsePoint(p, cellEnd);
+        if (pointValid(point)) {
+          batch->points.push_back(point);
+          IdMapping idm{0, batch->points.size() - 1};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
         } else {
-          c++;
-          continue;
+          IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
         }
-      case IN_ROW:
-        if (*c == '\t' || *c == '\n') {
-          // bool isGeom = util::endsWith(
-          // _dangling, "^^<http://www.opengis.net/ont/geosparql#wktLiteral>");
-
-          bool isGeom = true;
-
-          auto p = _dangling.rfind("\"POINT(", 0);
-
-          // if the previous was not a multi geometry, and if the strings
-          // match exactly, re-use the geometry
-          if (isGeom && _prev == _dangling && _lastQidToId.qid == 0) {
-            IdMapping idm{0, _lastQidToId.id};
-            _lastQidToId = idm;
-            _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                            sizeof(IdMapping));
-            _qidToIdFSize++;
-          } else if (isGeom && p != std::string::npos) {
-            _curUniqueGeom++;
-            p += 7;
-            auto point = parsePoint(_dangling, p);
-            if (pointValid(point)) {
-              _pointsF.write(reinterpret_cast<const char *>(&point),
-                             sizeof(util::geo::FPoint));
-              _pointsFSize++;
-              IdMapping idm{0, _pointsFSize - 1};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
-            } else {
-              IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
-            }
-          } else if (isGeom && (p = _dangling.rfind("\"LINESTRING(", 0)) !=
-                                   std::string::npos) {
-            _curUniqueGeom++;
-            p += 12;
-            const auto &line = parseLineString(_dangling, p);
-            if (line.size() == 0) {
-              IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
-            } else {
-              _linesF.write(reinterpret_cast<const char *>(&_linePointsFSize),
-                            sizeof(size_t));
-              _linesFSize++;
-              insertLine(line, false);
-
-              IdMapping idm{0, I_OFFSET + _linesFSize - 1};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
-            }
-          } else if (isGeom && (p = _dangling.rfind("\"MULTILINESTRING(", 0)) !=
-                                   std::string::npos) {
-            _curUniqueGeom++;
-            p += 17;
-            size_t i = 0;
-            while ((p = _dangling.find("(", p + 1)) != std::string::npos) {
-              const auto &line = parseLineString(_dangling, p + 1);
-              if (line.size() == 0) {
-                if (i == 0) {
-                  IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-                  _lastQidToId = idm;
-                  _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                                  sizeof(IdMapping));
-                  _qidToIdFSize++;
-                }
-              } else {
-                _linesF.write(reinterpret_cast<const char *>(&_linePointsFSize),
-                              sizeof(size_t));
-                _linesFSize++;
-                insertLine(line, false);
-
-                IdMapping idm{i == 0 ? 0 : 1, I_OFFSET + _linesFSize - 1};
-                _lastQidToId = idm;
-                _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                                sizeof(IdMapping));
-                _qidToIdFSize++;
-              }
-              i++;
-            }
+      } else if (isGeom && (p = wktPrefix(c, cellEnd, "\"MULTIPOINT("))) {
+        batch->uniqueGeoms++;
+        size_t i = 0;
+        while (p < cellEnd) {
+          // members may be wrapped in parentheses
+          while (p < cellEnd && (*p == ' ' || *p == '(')) p++;
+          if (p == cellEnd || *p == ')') break;
+
+          auto point = parsePoint(p, cellEnd);
+          if (pointValid(point)) {
+            batch->points.push_back(point);
+            IdMapping idm{i == 0 ? 0 : 1, batch->points.size() - 1};
+            lastQidToId = idm;
+            batch->qidToId.push_back(idm);
+            i++;
+          }
+
+          while (p < cellEnd && *p != ',' && *p != ')') p++;
+          if (p < cellEnd && *p == ')') {
+            // either the end of a wrapped member or of the list
+            p++;
+            while (p < cellEnd && *p == ' ') p++;
+            if (p == cellEnd || *p != ',') break;
+          }
+          p++;
+        }
+        if (i == 0) {
+          IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
+        }
+      } else if (isGeom && (p = wktPrefix(c, cellEnd, "\"LINESTRING("))) {
+        batch->uniqueGeoms++;
+        const auto &line = parseLineString(p, cellEnd);
+        if (line.size() == 0) {
+          IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
+        } else {
+          batch->lines.push_back(batch->linePoints.size());
+          insertLine(line, false, false, batch);
+
+          IdMapping idm{0, I_OFFSET + batch->lines.size() - 1};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
+        }
+      } else if (isGeom &&
+                 (p = wktPrefix(c, cellEnd, "\"MULTILINESTRING("))) {
+        batch->uniqueGeoms++;
+        size_t i = 0;
+        // p - 1 is the opening parenthesis, the parts start after it
+        while ((p = wktFind(p, cellEnd, '('))) {
+          p++;
+          const auto &line = parseLineString(p, cellEnd);
+          if (line.size() == 0) {
             if (i == 0) {
               IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
-            }
-          } else if (isGeom && (p = _dangling.rfind("\"POLYGON(", 0)) !=
-                                   std::string::npos) {
-            _curUniqueGeom++;
-            p += 9;
-            size_t i = 0;
-            while ((p = _dangling.find("(", p + 1)) != std::string::npos) {
-              const auto &line = parseLineString(_dangling, p + 1);
-              if (line.size() == 0) {
-                if (i == 0) {
-                  IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-                  _lastQidToId = idm;
-                  _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                                  sizeof(IdMapping));
-                  _qidToIdFSize++;
-                }
-              } else {
-                _linesF.write(reinterpret_cast<const char *>(&_linePointsFSize),
-                              sizeof(size_t));
-                _linesFSize++;
-                insertLine(line, true);
-
-                IdMapping idm{i == 0 ? 0 : 1, I_OFFSET + _linesFSize - 1};
-                _lastQidToId = idm;
-                _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                                sizeof(IdMapping));
-                _qidToIdFSize++;
-              }
-              i++;
+              lastQidToId = idm;
+              batch->qidToId.push_back(idm);
             }
+          } else {
+            batch->lines.push_back(batch->linePoints.size());
+            insertLine(line, false, false, batch);
+
+            IdMapping idm{i == 0 ? 0 : 1,
+                          I_OFFSET + batch->lines.size() - 1};
+            lastQidToId = idm;
+            batch->qidToId.push_back(idm);
+          }
+          i++;
+        }
+        if (i == 0) {
+          IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
+        }
+      } else if (isGeom && (p = wktPrefix(c, cellEnd, "\"POLYGON("))) {
+        batch->uniqueGeoms++;
+        size_t i = 0;
+        // p - 1 is the opening parenthesis, the rings start after it
+        while ((p = wktFind(p, cellEnd, '('))) {
+          p++;
+          // the first ring is the outer ring, all others are holes
+          const auto &line = parseLineString(p, cellEnd);
+          if (line.size() == 0) {
             if (i == 0) {
               IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
-            }
-          } else if (isGeom && (p = _dangling.rfind("\"MULTIPOLYGON(", 0)) !=
-                                   std::string::npos) {
-            _curUniqueGeom++;
-            p += 13;
-            size_t i = 0;
-            while ((p = _dangling.find("(", p + 1)) != std::string::npos) {
-              if (_dangling[p + 1] == '(') p++;
-              const auto &line = parseLineString(_dangling, p + 1);
-              if (line.size() == 0) {
-                if (i == 0) {
-                  IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-                  _lastQidToId = idm;
-                  _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                                  sizeof(IdMapping));
-                  _qidToIdFSize++;
-                }
-              } else {
-                _linesF.write(reinterpret_cast<const char *>(&_linePointsFSize),
-                              sizeof(size_t));
-                _linesFSize++;
-                insertLine(line, true);
-
-                IdMapping idm{i == 0 ? 0 : 1, I_OFFSET + _linesFSize - 1};
-                _lastQidToId = idm;
-                _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                                sizeof(IdMapping));
-                _qidToIdFSize++;
-              }
-              i++;
+              lastQidToId = idm;
+              batch->qidToId.push_back(idm);
             }
+          } else {
+            batch->lines.push_back(batch->linePoints.size());
+            insertLine(line, true, i > 0, batch);
+
+            IdMapping idm{i == 0 ? 0 : 1,
+                          I_OFFSET + batch->lines.size() - 1};
+            lastQidToId = idm;
+            batch->qidToId.push_back(idm);
+          }
+          i++;
+        }
+        if (i == 0) {
+          IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
+        }
+      } else if (isGeom && (p = wktPrefix(c, cellEnd, "\"MULTIPOLYGON("))) {
+        batch->uniqueGeoms++;
+        size_t i = 0;
+        while ((p = wktFind(p, cellEnd, '('))) {
+          p++;
+          // a new polygon starts with its outer ring, all other rings of
+          // a polygon are holes
+          bool isHole = true;
+          if (p < cellEnd && *p == '(') {
+            isHole = false;
+            p++;
+          }
+          const auto &line = parseLineString(p, cellEnd);
+          if (line.size() == 0) {
             if (i == 0) {
               IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-              _lastQidToId = idm;
-              _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                              sizeof(IdMapping));
-              _qidToIdFSize++;
+              lastQidToId = idm;
+              batch->qidToId.push_back(idm);
             }
           } else {
-            IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
-            _lastQidToId = idm;
-            _qidToIdF.write(reinterpret_cast<const char *>(&idm),
-                            sizeof(IdMapping));
-            _qidToIdFSize++;
-          }
+            batch->lines.push_back(batch->linePoints.size());
+            insertLine(line, true, isHole, batch);
 
-          if (*c == '\n') {
-            _curRow++;
-            if (_curRow % 1000000 == 0) {
-              LOG(INFO) << "[GEOMCACHE] "
-                        << "@ row " << _curRow << " (" << std::fixed
-                        << std::setprecision(2) << getLoadStatusPercent()
-                        << "%, " << _pointsFSize << " points, " << _linesFSize
-                        << " (open) polygons, " << _geometryDuplicates
-                        << " duplicates)";
-            }
-            _prev = _dangling;
-            _dangling.clear();
-            c++;
-            continue;
-          } else {
-            _prev = _dangling;
-            _dangling.clear();
-            c++;
-            continue;
+            IdMapping idm{i == 0 ? 0 : 1,
+                          I_OFFSET + batch->lines.size() - 1};
+            lastQidToId = idm;
+            batch->qidToId.push_back(idm);
           }
+          i++;
+        }
+        if (i == 0) {
+          IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+          lastQidToId = idm;
+          batch->qidToId.push_back(idm);
         }
+      } else {
+        IdMapping idm{0, std::numeric_limits<ID_TYPE>::max()};
+        lastQidToId = idm;
+        batch->qidToId.push_back(idm);
+      }
 
-        _dangling += toupper(*c);
-        c++;
+      if (!samePrev && _keepFingerprints) {
+        batch->rowFingerprints.push_back({qidIdx, hash, check});
+      }
 
-        break;
-      default:
-        break;
+      prev = c;
+      prevLen = len;
+      c = cellEnd + 1;
+
+      if (cellEnd == rowEnd) break;
     }
+
+    batch->numRows++;
+  }
+
+  // fingerprints of the encoded geometries, for the deduplication
+  batch->pointHashes.reserve(batch->points.size());
+  for (const auto &p : batch->points) {
+    batch->pointHashes.push_back(geomHash(&p, sizeof(util::geo::FPoint)));
+  }
+
+  batch->lineHashes.reserve(batch->lines.size());
+  for (size_t i = 0; i < batch->lines.size(); i++) {
+    size_t end = i + 1 < batch->lines.size() ? batch->lines[i + 1]
+                                             : batch->linePoints.size();
+    batch->lineHashes.push_back(
+        geomHash(&batch->linePoints[batch->lines[i]],
+                 (end - batch->lines[i]) * sizeof(util::geo::Point<int16_t>)));
   }
 }
 
@@ -424,58 +1211,73 @@ size_t GeomCache::getCurrentProgress() { return _curRow; }
 void GeomCache::parseIds(const char *c, size_t size) {
   _loadStatusStage = _LoadStatusStages::ParseIds;
 
-  size_t lastQid = -1;
-  for (size_t i = 0; i < size; i++) {
-    if (_raw.size() < 10000) _raw.push_back(c[i]);
-    _curId.bytes[_curByte] = c[i];
+  if (_raw.size() < 10000) _raw.append(c, std::min(size, 10000 - _raw.size()));
+
+  // complete the id started in the previous callback
+  while (_curByte != 0 && size > 0) {
+    _curId.bytes[_curByte] = *c;
     _curByte = (_curByte + 1) % 8;
+    c++;
+    size--;
+    if (_curByte == 0) insertId(_curId.val);
+  }
 
-    if (_curByte == 0) {
-      if (_curRow % 1000000 == 0) {
-        LOG(INFO) << "[GEOMCACHE] "
-                  << "@ row " << _curRow << " (" << std::fixed
-                  << std::setprecision(2) << getLoadStatusPercent() << "%, "
-                  << _pointsFSize << " points, " << _linesFSize
-                  << " (open) polygons)";
-      }
+  // whole ids are read directly from the buffer
+  for (; size >= 8; c += 8, size -= 8) {
+    uint64_t val;
+    memcpy(&val, c, 8);
+    insertId(val);
+  }
 
-      if (_curRow < _qidToId.size() && _qidToId[_curRow].qid == 0) {
-        // if we have two consecutive and equivalent QLever ids, the geometry
-        // was returned multiple times in the fill query. This can happen if the
-        // same WKT string is used in multiple distinct objects, but then stored
-        // in qlever using the same internal qlever ID. To avoid a false multi-
-        // plication of results (all geoms of matching qlever ID are joined), we
-        // set such repeated qlever IDs to an unnsed dummy value.
-        if (lastQid == _curId.val) {
-          LOG(DEBUG) << "Found duplicate internal qlever ID " << _curId.val
-                     << " for row " << _curRow
-                     << ", ignoring this geometry duplicate!";
-          _qidToId[_curRow].qid = -1;
-          _geometryDuplicates++;
-        } else {
-          _qidToId[_curRow].qid = _curId.val;
-        }
-        lastQid = _curId.val;
-        if (_curId.val > _maxQid) _maxQid = _curId.val;
-      } else {
-        LOG(WARN) << "The results for the binary IDs are out of sync.";
-        LOG(WARN) << "_curRow: " << _curRow
-                  << " _qleverIdInt.size: " << _qidToId.size()
-                  << " cur val: " << _qidToId[_curRow].qid;
-      }
+  // keep an incomplete id for the next callback
+  for (; size > 0; c++, size--) _curId.bytes[_curByte++] = *c;
+}
 
-      // if a qlever entity contained multiple geometries (MULTILINESTRING,
-      // MULTIPOLYGON, MULTIPOINT), they appear consecutively in
-      // _qidToId; continuation geometries are marked by a
-      // preliminary qlever ID of 1, while the first geometry always has a
-      // preliminary id of 0
-      while (_curRow < _qidToId.size() - 1 && _qidToId[_curRow + 1].qid == 1) {
-        _qidToId[++_curRow].qid = _curId.val;
-      }
+// _____________________________________________________________________________
+void GeomCache::insertId(uint64_t val) {
+  if (_curRow % 1000000 == 0) {
+    LOG(INFO) << "[GEOMCACHE] "
+              << "@ row " << _curRow << " (" << std::fixed
+              << std::setprecision(2) << getLoadStatusPercent() << "%, "
+              << _points.size() << " points, " << _lines.size()
+              << " (open) polygons)";
+  }
 
-      _curRow++;
+  if (_curRow < _qidToId.size() && _qidToId[_curRow].qid == 0) {
+    // if we have two consecutive and equivalent QLever ids, the geometry
+    // was returned multiple times in the fill query. This can happen if the
+    // same WKT string is used in multiple distinct objects, but then stored
+    // in qlever using the same internal qlever ID. To avoid a false multi-
+    // plication of results (all geoms of matching qlever ID are joined), we
+    // set such repeated qlever IDs to an unnsed dummy value.
+    if (_lastQid == val) {
+      LOG(DEBUG) << "Found duplicate internal qlever ID " << val
+                 << " for row " << _curRow
+                 << ", ignoring this geometry duplicate!";
+      _qidToId[_curRow].qid = -1;
+      _geometryDuplicates++;
+    } else {
+      _qidToId[_curRow].qid = val;
     }
+    _lastQid = val;
+    if (val > _maxQid) _maxQid = val;
+  } else {
+    LOG(WARN) << "The results for the binary IDs are out of sync.";
+    LOG(WARN) << "_curRow: " << _curRow
+              << " _qleverIdInt.size: " << _qidToId.size()
+              << " cur val: " << _qidToId[_curRow].qid;
+  }
+
+  // if a qlever entity contained multiple geometries (MULTILINESTRING,
+  // MULTIPOLYGON, MULTIPOINT), they appear consecutively in
+  // _qidToId; continuation geometries are marked by a
+  // preliminary qlever ID of 1, while the first geometry always has a
+  // preliminary id of 0
+  while (_curRow < _qidToId.size() - 1 && _qidToId[_curRow + 1].qid == 1) {
+    _qidToId[++_curRow].qid = val;
   }
+
+  _curRow++;
 }
 
 // _____________________________________________________________________________
@@ -558,171 +1360,744 @@ size_t GeomCache::requestSize() {
 }
 
 // _____________________________________________________________________________
-void GeomCache::requestPart(size_t offset) {
-  _state = IN_HEADER;
-  _dangling.clear();
-  _dangling.reserve(10000);
-  _raw.clear();
-  _raw.reserve(10000);
+void GeomCache::startPart(FillPart *part) const {
+  part->raw.reserve(10000);
+  part->dangling.reserve(10000);
+
+  auto qUrl =
+      queryUrl(part->hashes ? getHashQuery(_backendUrl) : getQuery(_backendUrl),
+               part->offset, FILL_WINDOW);
+  curl_easy_setopt(part->curl, CURLOPT_URL, qUrl.c_str());
+  curl_easy_setopt(part->curl, CURLOPT_WRITEFUNCTION, GeomCache::writeCb);
+  curl_easy_setopt(part->curl, CURLOPT_WRITEDATA, part);
+  curl_easy_setopt(part->curl, CURLOPT_PRIVATE, part);
+  curl_easy_setopt(part->curl, CURLOPT_ERRORBUFFER, part->errbuf);
+  curl_easy_setopt(part->curl, CURLOPT_SSL_VERIFYPEER, false);
+  curl_easy_setopt(part->curl, CURLOPT_SSL_VERIFYHOST, false);
+
+  // set headers
+  part->headers =
+      curl_slist_append(part->headers, "Accept: text/tab-separated-values");
+  curl_easy_setopt(part->curl, CURLOPT_HTTPHEADER, part->headers);
+
+  // accept any compression supported
+  curl_easy_setopt(part->curl, CURLOPT_ACCEPT_ENCODING, "");
+}
+
+// _____________________________________________________________________________
+void GeomCache::checkPart(FillPart *part, CURLcode res) const {
+  long httpCode = 0;
+  curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &httpCode);
+
+  if (httpCode != 200) {
+    std::stringstream ss;
+    ss << "QLever backend returned status code " << httpCode
+       << " during query (offset=" << part->offset << ")";
+    ss << "\n";
+    ss << part->raw;
+    throw std::runtime_error(ss.str());
+  }
+
+  if (part->exceptionPtr) std::rethrow_exception(part->exceptionPtr);
+
+  // the windows have fixed offsets, so an incomplete window cannot be
+  // continued by the next one
+  if (res != CURLE_OK) {
+    std::stringstream ss;
+    ss << "Request failed during query (offset=" << part->offset << "): ";
+    if (strlen(part->errbuf) > 0) {
+      ss << part->errbuf;
+    } else {
+      ss << curl_easy_strerror(res);
+    }
+    throw std::runtime_error(ss.str());
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::refreshPart(FillPart *part) {
+  const auto &known = part->known;
+  part->hashes = false;
+  part->dangling.clear();
+
+  // the rows without a fingerprint of the previous fill, in runs of
+  // consecutive rows
+  std::vector<std::pair<size_t, size_t>> runs;
+  for (size_t i = 0; i < known.size(); i++) {
+    if (known[i] != FINGERPRINT_NONE) continue;
+    if (!runs.empty() && runs.back().second == i) {
+      runs.back().second++;
+    } else {
+      runs.push_back({i, i + 1});
+    }
+  }
+
+  // small gaps of known rows are fetched along, and at most REFRESH_MAX_RUNS
+  // requests are made per window
+  size_t maxGap = REFRESH_GAP;
+  if (runs.size() > REFRESH_MAX_RUNS) {
+    std::vector<size_t> gaps;
+    for (size_t j = 1; j < runs.size(); j++) {
+      gaps.push_back(runs[j].first - runs[j - 1].second);
+    }
+    size_t k = runs.size() - REFRESH_MAX_RUNS - 1;
+    std::nth_element(gaps.begin(), gaps.begin() + k, gaps.end());
+    maxGap = std::max(maxGap, gaps[k]);
+  }
+
+  size_t num = 0;
+  size_t numRuns = 0;
+  for (size_t j = 0; j < runs.size(); j++) {
+    if (numRuns > 0 && runs[j].first - runs[numRuns - 1].second <= maxGap) {
+      runs[numRuns - 1].second = runs[j].second;
+    } else {
+      runs[numRuns++] = runs[j];
+    }
+  }
+  runs.resize(numRuns);
+  for (const auto &run : runs) num += run.second - run.first;
+
+  // if most rows changed, the whole window is fetched at once
+  if (2 * num > known.size()) {
+    runs.assign(1, {0, known.size()});
+    num = known.size();
+  }
+  _refreshRows += num;
+
+  // known rows are handed to the parse workers as their fingerprint
+  auto addKnown = [this, part](size_t fp) {
+    part->dangling += '#';
+    part->dangling += std::to_string(fp);
+    part->dangling += '\n';
+    if (part->dangling.size() >= PARSE_BATCH_SIZE) queueParseBatch(part, false);
+  };
+
+  size_t i = 0;
+  for (const auto &run : runs) {
+    for (; i < run.first; i++) addKnown(known[i]);
+    fetchRows(part, run.first, run.second - run.first);
+    i = run.second;
+  }
+  for (; i < known.size(); i++) addKnown(known[i]);
+
+  std::vector<size_t>().swap(part->known);
+}
+
+// _____________________________________________________________________________
+void GeomCache::fetchRows(FillPart *part, size_t start, size_t num) {
+  // the rows are parsed as usual, after the rows already in the buffer
+  auto qUrl = queryUrl(getQuery(_backendUrl), part->offset + start, num);
+  curl_easy_setopt(part->curl, CURLOPT_URL, qUrl.c_str());
+  part->state = IN_HEADER;
+  part->numRows = 0;
+  part->raw.clear();
+
+  checkPart(part, curl_easy_perform(part->curl));
+
+  if (part->numRows != num) {
+    std::stringstream ss;
+    ss << "QLever backend returned " << part->numRows << " instead of " << num
+       << " rows during query (offset=" << part->offset + start << ")";
+    throw std::runtime_error(ss.str());
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::finishPart(FillPart *part, CURLcode res) {
+  checkPart(part, res);
+
+  // only the hashes of the rows were fetched so far
+  if (part->hashes) refreshPart(part);
+
+  queueParseBatch(part, true);
+
+  {
+    std::lock_guard<std::mutex> lock(_parseM);
+    _partBatches[part->part] = part->numBatches;
+  }
+
+  // all batches of this window may already have been stitched
+  stitchParsed();
+}
+
+// _____________________________________________________________________________
+void GeomCache::request() {
+  _totalSize = requestSize();
+  _geometryDuplicates = 0;
+
+  if (_totalSize == 0) {
+    throw std::runtime_error(
+        "Could not determine number of rows, or number of rows was 0");
+  }
+
+  _state = IN_HEADER;
+
+  // if the previous fill left fingerprints, its geometries are re-used for
+  // all rows with an unchanged WKT
+  if (_fingerprints.size()) {
+    LOG(INFO) << "[GEOMCACHE] Refreshing incrementally, "
+              << _fingerprints.size() << " row fingerprints available";
+    decompressLines();
+    _refreshPoints = std::move(_points);
+    _refreshLinePoints = std::move(_linePoints);
+    _refreshLines = std::move(_lines);
+    _refreshFingerprints = std::move(_fingerprints);
+    _refreshFingerprintIds = std::move(_fingerprintIds);
+
+    // only the WKT of changed rows is fetched, if the backend can hash them
+    _hashRefresh = hashQuerySupported();
+    if (!_hashRefresh) {
+      LOG(WARN) << "[GEOMCACHE] Backend does not support the hash query, "
+                << "fetching the WKT of all rows";
+    }
+  } else {
+    _hashRefresh = false;
+  }
+  _refreshedGeoms = 0;
+  _refreshRows = 0;
+
+  _points.clear();
+  _lines.clear();
+  _linePoints.clear();
+  _lineBytes.free();
+  _linesCompressed = false;
+  _lineLods.clear();
+  _lods.clear();
+  _lodPoints.clear();
+  _qidToId.clear();
+  _fingerprints.clear();
+  _fingerprintIds.clear();
+
+  _raw.clear();
+  _raw.reserve(100000);
+
+  _curRow = 0;
+  _curUniqueGeom = 0;
+
+  _geomSlots.assign(1 << 20, GEOM_SLOT_EMPTY);
+  _numGeomSlots = 0;
+  _dedupGeoms = 0;
+  _dedupBytes = 0;
+
+  LOG(INFO) << "[GEOMCACHE] Total request size: " << _totalSize;
+  LOG(INFO) << "[GEOMCACHE] Query is:\n" << getQuery(_backendUrl);
+
+  startParseWorkers();
+
+  CURLM *multi = curl_multi_init();
+  if (!multi) throw std::runtime_error("Failed to perform curl request.");
+
+  std::vector<std::unique_ptr<FillPart>> parts;
+  size_t running = 0;
+
+  try {
+    // the first window which returned less than FILL_WINDOW rows
+    size_t lastPart = std::numeric_limits<size_t>::max();
+
+    while (true) {
+      size_t stitched;
+      {
+        std::lock_guard<std::mutex> lock(_parseM);
+        if (_parseExceptionPtr) std::rethrow_exception(_parseExceptionPtr);
+        stitched = _stitchPart;
+
+        for (size_t j = 0; j < stitched && j < lastPart; j++) {
+          if (_partRows[j] < FILL_WINDOW) lastPart = j;
+        }
+      }
+
+      // windows within the expected result size are requested concurrently,
+      // beyond it (if the count was off) only one at a time
+      while (running < _fillRequests && parts.size() <= lastPart &&
+             (parts.size() * FILL_WINDOW < _totalSize ||
+              stitched == parts.size())) {
+        {
+          std::lock_guard<std::mutex> lock(_parseM);
+          _partBatches.push_back(std::numeric_limits<size_t>::max());
+          _partRows.push_back(0);
+        }
+
+        parts.emplace_back(
+            new FillPart(this, parts.size(), parts.size() * FILL_WINDOW));
+        if (!parts.back()->curl) {
+          throw std::runtime_error("Failed to perform curl request.");
+        }
+        parts.back()->hashes = _hashRefresh;
+        startPart(parts.back().get());
+        curl_multi_add_handle(multi, parts.back()->curl);
+        running++;
+      }
+
+      if (running == 0) {
+        if (stitched == parts.size()) break;
+
+        // wait until the next window has been stitched
+        std::unique_lock<std::mutex> lock(_parseM);
+        _parsedCv.wait(lock, [this, stitched] {
+          return _stitchPart > stitched || _parseExceptionPtr;
+        });
+        continue;
+      }
+
+      int numRunning = 0;
+      curl_multi_perform(multi, &numRunning);
+
+      CURLMsg *msg;
+      int numMsgs;
+      while ((msg = curl_multi_info_read(multi, &numMsgs))) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL *curl = msg->easy_handle;
+        CURLcode res = msg->data.result;
+
+        FillPart *part = 0;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, &part);
+        curl_multi_remove_handle(multi, curl);
+        running--;
+
+        finishPart(part, res);
+        part->raw.clear();
+        part->raw.shrink_to_fit();
+        part->dangling.clear();
+        part->dangling.shrink_to_fit();
+      }
+
+      if (running > 0) curl_multi_wait(multi, 0, 0, 1000, 0);
+    }
+  } catch (...) {
+    for (auto &part : parts) curl_multi_remove_handle(multi, part->curl);
+    curl_multi_cleanup(multi);
+    stopParseWorkers();
+    freeRefresh();
+    throw;
+  }
+
+  curl_multi_cleanup(multi);
+  stopParseWorkers();
+  freeRefresh();
+
+  std::vector<uint64_t>().swap(_geomSlots);
+
+  // sorted for the lookups of the next refresh, of rows with an identical
+  // WKT only the first is kept
+  std::sort(_fingerprints.begin(), _fingerprints.end());
+  auto fpEnd = std::unique(
+      _fingerprints.begin(), _fingerprints.end(),
+      [](const GeomFingerprint &a, const GeomFingerprint &b) {
+        return a.hash == b.hash && a.check == b.check;
+      });
+  _fingerprints.resize(fpEnd - _fingerprints.begin());
+
+  LOG(INFO) << "[GEOMCACHE] Done";
+  LOG(INFO) << "[GEOMCACHE] Received " << _curUniqueGeom << " unique geoms ("
+            << _geometryDuplicates << " geometry duplicates transferred)";
+  LOG(INFO) << "[GEOMCACHE] Stored " << _dedupGeoms
+            << " non-adjacent duplicate geoms only once (" << _dedupBytes
+            << " bytes saved)";
+  LOG(INFO) << "[GEOMCACHE] Re-used " << _refreshedGeoms
+            << " unchanged geoms from the previous fill";
+  if (_hashRefresh) {
+    LOG(INFO) << "[GEOMCACHE] Fetched the WKT of " << _refreshRows << " of "
+              << _curRow << " rows";
+  }
+  LOG(INFO) << "[GEOMCACHE] Received " << _points.size() << " points and "
+            << _lines.size() << " lines";
+
+  if (_hilbertOrder) hilbertOrder();
+
+  buildLods();
+}
+
+// _____________________________________________________________________________
+void GeomCache::freeRefresh() {
+  _refreshPoints.free();
+  _refreshLinePoints.free();
+  _refreshLines.free();
+  _refreshFingerprints.free();
+  _refreshFingerprintIds.free();
+}
+
+// _____________________________________________________________________________
+bool GeomCache::hashQuerySupported() {
+  // the hash of the first row, fails if the backend does not know MD5()
+  std::string response;
+  char errbuf[CURL_ERROR_SIZE];
+
+  auto qUrl = queryUrl(getHashQuery(_backendUrl), 0, 1);
+  curl_easy_setopt(_curl, CURLOPT_URL, qUrl.c_str());
+  curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, GeomCache::writeCbString);
+  curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &response);
+  curl_easy_setopt(_curl, CURLOPT_ERRORBUFFER, errbuf);
+  curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYPEER, false);
+  curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYHOST, false);
+
+  // set headers
+  struct curl_slist *headers = 0;
+  headers = curl_slist_append(headers, "Accept: text/tab-separated-values");
+  curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, headers);
+
+  // accept any compression supported
+  curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, "");
+  CURLcode res = curl_easy_perform(_curl);
+
+  long httpCode = 0;
+  curl_easy_getinfo(_curl, CURLINFO_RESPONSE_CODE, &httpCode);
+
+  curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, 0);
+  curl_slist_free_all(headers);
+
+  if (res != CURLE_OK || httpCode != 200) return false;
+
+  // the header, followed by at most one row
+  size_t rowStart = response.find('\n');
+  if (rowStart == std::string::npos) return false;
+  rowStart++;
+  size_t rowEnd = response.find('\n', rowStart);
+  if (rowEnd == std::string::npos) return rowStart == response.size();
+
+  uint64_t hash;
+  uint32_t check;
+  return hexFingerprint(response.data() + rowStart, rowEnd - rowStart, &hash,
+                        &check);
+}
+
+// _____________________________________________________________________________
+void GeomCache::lodSignificance(const LineCoord *c, size_t n,
+                                std::vector<double> *sig) {
+  // Writes the largest Douglas-Peucker tolerance (in decimeters) at which
+  // each of the n vertices c is kept to sig. The splits of Douglas-Peucker
+  // do not depend on the tolerance, so the simplifications of all
+  // tolerances are nested, and this single pass yields all of them.
+  sig->assign(n, std::numeric_limits<double>::infinity());
+  if (n < 3) return;
+
+  struct Span {
+    size_t a, b;
+    double sig;
+  };
+
+  std::vector<Span> stack;
+  stack.push_back({0, n - 1, std::numeric_limits<double>::infinity()});
+
+  while (!stack.empty()) {
+    Span s = stack.back();
+    stack.pop_back();
+    if (s.b - s.a < 2) continue;
+
+    double ax = c[s.a].getX();
+    double ay = c[s.a].getY();
+    double dx = c[s.b].getX() - ax;
+    double dy = c[s.b].getY() - ay;
+    double len = dx * dx + dy * dy;
+
+    // the vertex farthest from the segment a-b
+    size_t m = s.a + 1;
+    double dMax = -1;
+    for (size_t i = s.a + 1; i < s.b; i++) {
+      double px = c[i].getX() - ax;
+      double py = c[i].getY() - ay;
+      double t = 0;
+      if (len > 0) t = std::min(1.0, std::max(0.0, (px * dx + py * dy) / len));
+      double ex = px - t * dx;
+      double ey = py - t * dy;
+      double d = ex * ex + ey * ey;
+      if (d > dMax) {
+        dMax = d;
+        m = i;
+      }
+    }
+
+    // a vertex is only kept if the vertex splitting its span is kept, too
+    (*sig)[m] = std::min(s.sig, std::sqrt(dMax));
+    stack.push_back({s.a, m, (*sig)[m]});
+    stack.push_back({m, s.b, (*sig)[m]});
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::buildLods() {
+  // the lines are simplified in contiguous parts, one per thread, which are
+  // concatenated in order afterwards
+  struct LodPart {
+    std::vector<uint32_t> lineLods;
+    std::vector<size_t> lods;
+    std::vector<util::geo::Point<int16_t>> points;
+  };
 
-  CURLcode res;
-  char errbuf[CURL_ERROR_SIZE];
+  size_t numThreads = std::max<size_t>(
+      1, std::min<size_t>(std::thread::hardware_concurrency(),
+                          _lines.size() / LOD_MIN_PART));
+  size_t partSize = (_lines.size() + numThreads - 1) / numThreads;
+  std::vector<LodPart> parts(numThreads);
+
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+  for (size_t t = 0; t < numThreads; t++) {
+    auto &part = parts[t];
+    std::vector<LineCoord> coords, level;
+    std::vector<double> sig;
+
+    size_t partEnd = std::min(_lines.size(), (t + 1) * partSize);
+    for (size_t i = t * partSize; i < partEnd; i++) {
+      const auto *start = _linePoints.data() + getLine(i);
+      const auto *end = _linePoints.data() + getLineEnd(i);
+
+      // bounding box corners, followed by the vertices
+      coords.clear();
+      lineCoords(start, end, &coords);
+
+      if (coords.size() < 2 + LOD_MIN_POINTS) {
+        part.lineLods.push_back(LOD_NONE);
+        continue;
+      }
 
-  if (_curl) {
-    auto qUrl = queryUrl(getQuery(_backendUrl), offset, 1000000);
-    curl_easy_setopt(_curl, CURLOPT_URL, qUrl.c_str());
-    curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, GeomCache::writeCb);
-    curl_easy_setopt(_curl, CURLOPT_WRITEDATA, this);
-    curl_easy_setopt(_curl, CURLOPT_ERRORBUFFER, errbuf);
-    curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYPEER, false);
-    curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYHOST, false);
-    curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, 0);
+      size_t n = coords.size() - 2;
+      lodSignificance(coords.data() + 2, n, &sig);
 
-    // set headers
-    struct curl_slist *headers = 0;
-    headers = curl_slist_append(headers, "Accept: text/tab-separated-values");
-    curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, headers);
+      size_t first = part.lods.size();
+      size_t firstPoint = part.points.size();
+      size_t prevNum = n;
 
-    // accept any compression supported
-    curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, "");
-    res = curl_easy_perform(_curl);
+      for (size_t k = 0; k < LOD_LEVELS; k++) {
+        part.lods.push_back(part.points.size());
 
-    long httpCode = 0;
-    curl_easy_getinfo(_curl, CURLINFO_RESPONSE_CODE, &httpCode);
+        level.assign(coords.begin(), coords.begin() + 2);
+        for (size_t j = 0; j < n; j++) {
+          if (sig[j] > LOD_EPS[k] * 10) level.push_back(coords[2 + j]);
+        }
 
-    curl_slist_free_all(headers);
+        // levels which do not at least halve the vertices of the next finer
+        // one are left empty, the finer one is used instead
+        if (level.size() - 2 > prevNum / 2) continue;
+        prevNum = level.size() - 2;
 
-    if (httpCode != 200) {
-      std::stringstream ss;
-      ss << "QLever backend returned status code " << httpCode
-         << " during query (offset=" << offset << ")";
-      ss << "\n";
-      ss << _raw;
-      throw std::runtime_error(ss.str());
+        linePoints(level.data(), level.data() + level.size(),
+                   end > start ? lineFlags(end) : 0, &part.points);
+      }
+
+      if (part.points.size() == firstPoint) {
+        part.lods.resize(first);
+        part.lineLods.push_back(LOD_NONE);
+        continue;
+      }
+
+      part.lods.push_back(part.points.size());
+      part.lineLods.push_back(first / (LOD_LEVELS + 1));
     }
+  }
 
-    if (_exceptionPtr) std::rethrow_exception(_exceptionPtr);
-  } else {
-    LOG(ERROR) << "[GEOMCACHE] Failed to perform curl request.";
-    return;
+  _lineLods.clear();
+  _lods.clear();
+  _lodPoints.clear();
+
+  for (auto &part : parts) {
+    size_t lodBase = _lods.size() / (LOD_LEVELS + 1);
+    size_t pointBase = _lodPoints.size();
+
+    for (auto &l : part.lineLods) {
+      if (l != LOD_NONE) l += lodBase;
+    }
+    for (auto &o : part.lods) o += pointBase;
+
+    _lineLods.append(part.lineLods.data(), part.lineLods.size());
+    _lods.append(part.lods.data(), part.lods.size());
+    _lodPoints.append(part.points.data(), part.points.size());
   }
 
-  // check if there was an error
-  if (res != CURLE_OK) {
-    size_t len = strlen(errbuf);
-    if (len > 0) {
-      LOG(ERROR) << "[GEOMCACHE] " << errbuf;
-    } else {
-      LOG(ERROR) << "[GEOMCACHE] " << curl_easy_strerror(res);
+  LOG(INFO) << "[GEOMCACHE] Built " << LOD_LEVELS << " levels of detail for "
+            << _lods.size() / (LOD_LEVELS + 1) << " lines ("
+            << _lodPoints.size() << " points)";
+}
+
+// _____________________________________________________________________________
+uint32_t GeomCache::hilbertKey(double x, double y) {
+  // position of the web mercator point (x, y) on a Hilbert curve through a
+  // 2^16 x 2^16 grid over the whole plane
+  const uint32_t n = 1 << 16;
+  uint32_t hx = std::min<double>(
+      n - 1, std::max(0.0, (x + WEB_MERC_EXT) / (2 * WEB_MERC_EXT) * n));
+  uint32_t hy = std::min<double>(
+      n - 1, std::max(0.0, (y + WEB_MERC_EXT) / (2 * WEB_MERC_EXT) * n));
+
+  uint32_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (hx & s) > 0;
+    uint32_t ry = (hy & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+
+    // rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        hx = n - 1 - hx;
+        hy = n - 1 - hy;
+      }
+      std::swap(hx, hy);
     }
   }
+
+  return d;
 }
 
 // _____________________________________________________________________________
-void GeomCache::request() {
-  _totalSize = requestSize();
-  _geometryDuplicates = 0;
+void GeomCache::hilbertOrder() {
+  // renumber the points and the (plain) lines in the order of their
+  // (bounding box center) position on a Hilbert curve, so that geometries
+  // close to each other on the map are also close to each other in memory
+  size_t numThreads = std::thread::hardware_concurrency();
+
+  std::vector<HilbertId> points(_points.size());
+  std::vector<HilbertId> lines(_lines.size());
+
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+  for (size_t i = 0; i < points.size(); i++) {
+    points[i] = {hilbertKey(_points[i].getX(), _points[i].getY()),
+                 static_cast<ID_TYPE>(i)};
+  }
 
-  if (_totalSize == 0) {
-    throw std::runtime_error(
-        "Could not determine number of rows, or number of rows was 0");
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+  for (size_t i = 0; i < lines.size(); i++) {
+    auto box = getLineReader(i).getBBox();
+    lines[i] = {hilbertKey((box.getLowerLeft().getX() +
+                            box.getUpperRight().getX()) / 2,
+                           (box.getLowerLeft().getY() +
+                            box.getUpperRight().getY()) / 2),
+                static_cast<ID_TYPE>(i)};
   }
 
-  _state = IN_HEADER;
-  _points.clear();
-  _lines.clear();
-  _linePoints.clear();
-  _qidToId.clear();
+  auto key = [](const HilbertId &h) { return h.key; };
+  petrimaps::radixSort(points.data(), points.size(), key, numThreads);
+  petrimaps::radixSort(lines.data(), lines.size(), key, numThreads);
 
-  _lastQidToId = {-1, -1};
+  // the new id of each old id
+  std::vector<ID_TYPE> pointIds(points.size());
+  std::vector<ID_TYPE> lineIds(lines.size());
 
-  _raw.clear();
-  _raw.reserve(100000);
+  MappedArray<FPoint> newPoints;
+  newPoints.resize(points.size());
 
-  char *pointsFName = strdup("pointsXXXXXX");
-  int i = mkstemp(pointsFName);
-  if (i == -1) throw std::runtime_error("Could not create temporary file");
-  _pointsF.open(pointsFName, std::ios::out | std::ios::in | std::ios::binary);
-
-  char *linePointsFName = strdup("linepointsXXXXXX");
-  i = mkstemp(linePointsFName);
-  if (i == -1) throw std::runtime_error("Could not create temporary file");
-  _linePointsF.open(linePointsFName,
-                    std::ios::out | std::ios::in | std::ios::binary);
-
-  char *linesFName = strdup("linesXXXXXX");
-  i = mkstemp(linesFName);
-  if (i == -1) throw std::runtime_error("Could not create temporary file");
-  _linesF.open(linesFName, std::ios::out | std::ios::in | std::ios::binary);
-
-  char *qidToIdFName = strdup("qidtoidXXXXXX");
-  i = mkstemp(qidToIdFName);
-  if (i == -1) throw std::runtime_error("Could not create temporary file");
-  _qidToIdF.open(qidToIdFName, std::ios::out | std::ios::in | std::ios::binary);
-
-  // immediately unlink
-  unlink(pointsFName);
-  unlink(linePointsFName);
-  unlink(linesFName);
-  unlink(qidToIdFName);
-
-  free(pointsFName);
-  free(linePointsFName);
-  free(linesFName);
-  free(qidToIdFName);
-
-  _pointsFSize = 0;
-  _linePointsFSize = 0;
-  _linesFSize = 0;
-  _qidToIdFSize = 0;
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+  for (size_t i = 0; i < points.size(); i++) {
+    newPoints[i] = _points[points[i].id];
+    pointIds[points[i].id] = i;
+  }
 
-  _curRow = 0;
-  _curUniqueGeom = 0;
+  OffsetIndex newLines;
+  size_t numLinePoints = 0;
+  for (size_t i = 0; i < lines.size(); i++) {
+    newLines.push_back(numLinePoints);
+    numLinePoints += getLineEnd(lines[i].id) - getLine(lines[i].id);
+    lineIds[lines[i].id] = i;
+  }
 
-  size_t lastNum = -1;
+  MappedArray<util::geo::Point<int16_t>> newLinePoints;
+  newLinePoints.resize(numLinePoints);
 
-  LOG(INFO) << "[GEOMCACHE] Total request size: " << _totalSize;
-  LOG(INFO) << "[GEOMCACHE] Query is:\n" << getQuery(_backendUrl);
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+  for (size_t i = 0; i < lines.size(); i++) {
+    size_t start = getLine(lines[i].id);
+    memcpy(static_cast<void *>(newLinePoints.data() + newLines[i]),
+           _linePoints.data() + start,
+           (getLineEnd(lines[i].id) - start) *
+               sizeof(util::geo::Point<int16_t>));
+  }
+
+  // rows without a geometry keep their id
+  auto remap = [&pointIds, &lineIds](ID_TYPE id) -> ID_TYPE {
+    if (id < I_OFFSET && id < pointIds.size()) return pointIds[id];
+    if (id >= I_OFFSET && id - I_OFFSET < lineIds.size()) {
+      return I_OFFSET + lineIds[id - I_OFFSET];
+    }
+    return id;
+  };
 
-  while (lastNum != 0) {
-    size_t offset = _curRow;
-    requestPart(offset);
-    lastNum = _curRow - offset;
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+  for (size_t i = 0; i < _qidToId.size(); i++) {
+    _qidToId[i].id = remap(_qidToId[i].id);
   }
 
-  if (i == -1) throw std::runtime_error("Could not create temporary file");
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+  for (size_t i = 0; i < _fingerprintIds.size(); i++) {
+    _fingerprintIds[i] = remap(_fingerprintIds[i]);
+  }
 
-  LOG(INFO) << "[GEOMCACHE] Building vectors...";
+  _points = std::move(newPoints);
+  _linePoints = std::move(newLinePoints);
+  _lines = std::move(newLines);
 
-  _points.resize(_pointsFSize);
-  _pointsF.seekg(0);
-  _pointsF.read(reinterpret_cast<char *>(&_points[0]),
-                sizeof(util::geo::FPoint) * _pointsFSize);
-  _pointsF.close();
+  LOG(INFO) << "[GEOMCACHE] Ordered " << _points.size() << " points and "
+            << _lines.size() << " lines along a Hilbert curve";
+}
 
-  _linePoints.resize(_linePointsFSize);
-  _linePointsF.seekg(0);
-  _linePointsF.read(reinterpret_cast<char *>(&_linePoints[0]),
-                    sizeof(util::geo::Point<int16_t>) * _linePointsFSize);
-  _linePointsF.close();
+// _____________________________________________________________________________
+void GeomCache::compressLines() {
+  if (_linesCompressed) return;
+
+  size_t before = _linePoints.size() * sizeof(util::geo::Point<int16_t>);
+
+  MappedArray<uint8_t> bytes;
+  OffsetIndex offsets;
+  std::vector<LineCoord> coords;
+  std::vector<util::geo::Point<int16_t>> check;
+  std::vector<uint8_t> buf;
+
+  for (size_t i = 0; i < _lines.size(); i++) {
+    const auto* start = _linePoints.data() + getLine(i);
+    const auto* end = _linePoints.data() + getLineEnd(i);
+    uint8_t flags = end > start ? lineFlags(end) : 0;
+
+    coords.clear();
+    lineCoords(start, end, &coords);
+
+    // the plain line must be exactly reproducible from the compressed one,
+    // which holds for all lines written by insertLine()
+    check.clear();
+    linePoints(coords.data(), coords.data() + coords.size(), flags, &check);
+    if (coords.size() < 2 || check.size() != static_cast<size_t>(end - start) ||
+        !std::equal(check.begin(), check.end(), start)) {
+      LOG(WARN) << "[GEOMCACHE] Line " << i
+                << " cannot be compressed, keeping line points uncompressed";
+      return;
+    }
 
-  _lines.resize(_linesFSize);
-  _linesF.seekg(0);
-  _linesF.read(reinterpret_cast<char *>(&_lines[0]),
-               sizeof(size_t) * _linesFSize);
-  _linesF.close();
+    buf.clear();
+    lineEncode(coords.data(), coords.data() + coords.size(), flags, &buf);
+    offsets.push_back(bytes.size());
+    bytes.append(buf.data(), buf.size());
+  }
 
-  _qidToId.resize(_qidToIdFSize);
-  _qidToIdF.seekg(0);
-  _qidToIdF.read(reinterpret_cast<char *>(&_qidToId[0]),
-                 sizeof(IdMapping) * _qidToIdFSize);
-  _qidToIdF.close();
+  bytes.resize(bytes.size() + LINE_PADDING);
 
-  LOG(INFO) << "[GEOMCACHE] Done";
-  LOG(INFO) << "[GEOMCACHE] Received " << _curUniqueGeom << " unique geoms ("
-            << _geometryDuplicates << " geometry duplicates transferred)";
-  LOG(INFO) << "[GEOMCACHE] Received " << _points.size() << " points and "
-            << _lines.size() << " lines";
+  _lines = std::move(offsets);
+  _linePoints.free();
+  _lineBytes = std::move(bytes);
+  _linesCompressed = true;
+
+  LOG(INFO) << "[GEOMCACHE] Compressed line points from " << before
+            << " to " << _lineBytes.size() << " bytes";
+}
+
+// _____________________________________________________________________________
+void GeomCache::decompressLines() {
+  if (!_linesCompressed) return;
+
+  MappedArray<util::geo::Point<int16_t>> points;
+  OffsetIndex offsets;
+  std::vector<LineCoord> coords;
+  std::vector<util::geo::Point<int16_t>> buf;
+
+  for (size_t i = 0; i < _lines.size(); i++) {
+    coords.clear();
+    uint8_t flags = lineDecodeAll(_lineBytes.data() + _lines[i], &coords);
+
+    buf.clear();
+    linePoints(coords.data(), coords.data() + coords.size(), flags, &buf);
+
+    offsets.push_back(points.size());
+    points.append(buf.data(), buf.size());
+  }
+
+  _lines = std::move(offsets);
+  _lineBytes.free();
+  _linePoints = std::move(points);
+  _linesCompressed = false;
 }
 
 // _____________________________________________________________________________
@@ -730,6 +2105,7 @@ void GeomCache::requestIds() {
   _curByte = 0;
   _curRow = 0;
   _curUniqueGeom = 0;
+  _lastQid = -1;
   _maxQid = 0;
   _exceptionPtr = 0;
 
@@ -778,7 +2154,8 @@ void GeomCache::requestIds() {
 
   // sorting by qlever id
   LOG(INFO) << "[GEOMCACHE] Sorting results by qlever ID...";
-  std::stable_sort(_qidToId.begin(), _qidToId.end());
+  radixSort(_qidToId.data(), _qidToId.size(),
+            std::thread::hardware_concurrency());
   LOG(INFO) << "[GEOMCACHE] ... done";
 }
 
@@ -825,67 +2202,110 @@ bool GeomCache::pointValid(const DPoint &p) {
 }
 
 // _____________________________________________________________________________
-util::geo::DLine GeomCache::parseLineString(const std::string &a,
-                                            size_t p) const {
+util::geo::DLine GeomCache::parseLineString(const char *p,
+                                            const char *end) const {
   util::geo::DLine line;
   line.reserve(2);
-  auto end = memchr(a.c_str() + p, ')', a.size() - p);
-  assert(end);
-
-  while (true) {
-    auto point = latLngToWebMerc(
-        DPoint(util::atof(a.c_str() + p, 10),
-               util::atof(static_cast<const char *>(
-                              memchr(a.c_str() + p, ' ', a.size() - p)) +
-                              1,
-                          10)));
+  parseCoords(p, end, &line);
+  projectCoords(&line);
 
-    if (pointValid(point)) line.push_back(point);
-
-    auto n = memchr(a.c_str() + p, ',', a.size() - p);
-    if (!n || n > end) break;
-    p = static_cast<const char *>(n) - a.c_str() + 1;
+  // drop invalid vertices
+  size_t j = 0;
+  for (size_t i = 0; i < line.size(); i++) {
+    if (pointValid(line[i])) line[j++] = line[i];
   }
+  line.erase(line.begin() + j, line.end());
 
-  // the 200 is the THRESHOLD from Server.cpp
-  // return util::geo::densify(util::geo::simplify(line, 3), 200 * 3);
-  return util::geo::densify(line, 200 * 3);
+  // lines are stored with their original vertices, they are densified
+  // where needed while reading them
+  return line;
 }
 
 // _____________________________________________________________________________
-util::geo::FPoint GeomCache::parsePoint(const std::string &a, size_t p) const {
-  auto point = latLngToWebMerc(FPoint(
-      util::atof(a.c_str() + p, 10),
-      util::atof(
-          static_cast<const char *>(memchr(a.c_str() + p, ' ', a.size() - p)) +
-              1,
-          10)));
+util::geo::FPoint GeomCache::parsePoint(const char *p,
+                                        const char *end) const {
+  double x, y;
+  parseCoord(parseCoord(p, end, &x), end, &y);
 
-  return point;
+  return latLngToWebMerc(FPoint(x, y));
 }
 
 // _____________________________________________________________________________
-std::pair<std::vector<std::pair<ID_TYPE, ID_TYPE>>, size_t>
-GeomCache::getRelObjects(const std::vector<IdMapping> &ids) const {
-  // (geom id, result row)
-  std::vector<std::pair<ID_TYPE, ID_TYPE>> ret;
+size_t GeomCache::getRelObjects(
+    const std::vector<IdMapping> &ids,
+    std::vector<std::pair<ID_TYPE, ID_TYPE>> *ret,
+    MemoryBudget *memory) const {
+  // the ids are split into partitions joined independently, each starting
+  // at a binary-searched position in _qidToId. The join is done twice, once
+  // to count the results of each partition and once to write them into
+  // their slice of ret.
+  size_t numParts = std::max<size_t>(
+      1, std::min<size_t>(std::thread::hardware_concurrency(),
+                          ids.size() / JOIN_MIN_PART));
+
+  std::vector<size_t> starts(numParts + 1);
+  std::vector<size_t> sizes(numParts);
+  std::vector<size_t> numObjects(numParts);
+  for (size_t p = 0; p <= numParts; p++) starts[p] = ids.size() * p / numParts;
+
+#pragma omp parallel for num_threads(numParts) schedule(static, 1)
+  for (size_t p = 0; p < numParts; p++) {
+    sizes[p] = joinRelObjects(ids, starts[p], starts[p + 1], 0, &numObjects[p]);
+  }
 
-  // in most cases, the return size will be exactly the size of the ids set
-  ret.reserve(ids.size());
+  std::vector<size_t> offsets(numParts + 1, 0);
+  for (size_t p = 0; p < numParts; p++) offsets[p + 1] = offsets[p] + sizes[p];
 
-  // only counts multi-geometries once
-  size_t numObjects = 0;
+  *ret = {};
+  reserveCharged(ret, offsets[numParts], memory);
+  ret->resize(offsets[numParts]);
 
-  size_t i = 0;
-  size_t j = 0;
+#pragma omp parallel for num_threads(numParts) schedule(static, 1)
+  for (size_t p = 0; p < numParts; p++) {
+    size_t num;
+    joinRelObjects(ids, starts[p], starts[p + 1], ret->data() + offsets[p],
+                   &num);
+  }
+
+  // only counts multi-geometries once, also across partition borders
+  size_t total = 0;
+  for (size_t p = 0; p < numParts; p++) {
+    total += numObjects[p];
+    if (sizes[p] && offsets[p] > 0 &&
+        (*ret)[offsets[p] - 1].second == (*ret)[offsets[p]].second) {
+      total--;
+    }
+  }
+
+  return total;
+}
 
-  while (i < ids.size() && j < _qidToId.size()) {
+// _____________________________________________________________________________
+size_t GeomCache::joinRelObjects(const std::vector<IdMapping> &ids,
+                                 size_t start, size_t end,
+                                 std::pair<ID_TYPE, ID_TYPE> *out,
+                                 size_t *numObjects) const {
+  // joins ids[start, end) against _qidToId, writes (geom id, result row) to
+  // out (if given) and returns the number of results
+  size_t n = 0;
+  *numObjects = 0;
+  if (start == end) return 0;
+
+  size_t i = start;
+  size_t j = std::lower_bound(_qidToId.begin(), _qidToId.end(), ids[start]) -
+             _qidToId.begin();
+
+  ID_TYPE lastRow = 0;
+
+  while (i < end && j < _qidToId.size()) {
     if (ids[i].qid == _qidToId[j].qid) {
       size_t prefJ = j;
 
       while (j < _qidToId.size() && ids[i].qid == _qidToId[j].qid) {
-        if (ret.size() == 0 || ret.back().second != ids[i].id) numObjects++;
-        ret.push_back({_qidToId[j].id, ids[i].id});
+        if (n == 0 || lastRow != ids[i].id) (*numObjects)++;
+        lastRow = ids[i].id;
+        if (out) out[n] = {_qidToId[j].id, ids[i].id};
+        n++;
         j++;
       }
 
@@ -916,11 +2336,12 @@ GeomCache::getRelObjects(const std::vector<IdMapping> &ids) const {
     }
   }
 
-  return {ret, numObjects};
+  return n;
 }
 
 // _____________________________________________________________________________
-void GeomCache::insertLine(const util::geo::DLine &l, bool isArea) {
+void GeomCache::insertLine(const util::geo::DLine &l, bool isArea,
+                           bool isHole, ParseBatch *batch) const {
   // we also add the line's bounding box here to also
   // compress that
   const auto &bbox = util::geo::getBoundingBox(l);
@@ -930,9 +2351,7 @@ void GeomCache::insertLine(const util::geo::DLine &l, bool isArea) {
 
   if (mainX != 0 || mainY != 0) {
     util::geo::Point<int16_t> p{mCoord(mainX), mCoord(mainY)};
-    _linePointsF.write(reinterpret_cast<const char *>(&p),
-                       sizeof(util::geo::Point<int16_t>));
-    _linePointsFSize++;
+    batch->linePoints.push_back(p);
   }
 
   // add bounding box lower left
@@ -942,9 +2361,7 @@ void GeomCache::insertLine(const util::geo::DLine &l, bool isArea) {
       (bbox.getLowerLeft().getY() * 10.0) - mainY * M_COORD_GRANULARITY;
 
   util::geo::Point<int16_t> p{minorXLoc, minorYLoc};
-  _linePointsF.write(reinterpret_cast<const char *>(&p),
-                     sizeof(util::geo::Point<int16_t>));
-  _linePointsFSize++;
+  batch->linePoints.push_back(p);
 
   // add bounding box upper left
   int16_t mainXLoc = (bbox.getUpperRight().getX() * 10.0) / M_COORD_GRANULARITY;
@@ -958,14 +2375,10 @@ void GeomCache::insertLine(const util::geo::DLine &l, bool isArea) {
     mainY = mainYLoc;
 
     util::geo::Point<int16_t> p{mCoord(mainX), mCoord(mainY)};
-    _linePointsF.write(reinterpret_cast<const char *>(&p),
-                       sizeof(util::geo::Point<int16_t>));
-    _linePointsFSize++;
+    batch->linePoints.push_back(p);
   }
   p = util::geo::Point<int16_t>{minorXLoc, minorYLoc};
-  _linePointsF.write(reinterpret_cast<const char *>(&p),
-                     sizeof(util::geo::Point<int16_t>));
-  _linePointsFSize++;
+  batch->linePoints.push_back(p);
 
   // add line points
   for (const auto &p : l) {
@@ -977,87 +2390,228 @@ void GeomCache::insertLine(const util::geo::DLine &l, bool isArea) {
       mainY = mainYLoc;
 
       util::geo::Point<int16_t> p{mCoord(mainX), mCoord(mainY)};
-      _linePointsF.write(reinterpret_cast<const char *>(&p),
-                         sizeof(util::geo::Point<int16_t>));
-      _linePointsFSize++;
+      batch->linePoints.push_back(p);
     }
 
     int16_t minorXLoc = (p.getX() * 10.0) - mainXLoc * M_COORD_GRANULARITY;
     int16_t minorYLoc = (p.getY() * 10.0) - mainYLoc * M_COORD_GRANULARITY;
 
     util::geo::Point<int16_t> pp{minorXLoc, minorYLoc};
-    _linePointsF.write(reinterpret_cast<const char *>(&pp),
-                       sizeof(util::geo::Point<int16_t>));
-    _linePointsFSize++;
+    batch->linePoints.push_back(pp);
   }
 
   // if we have an area, we end in a major coord (which is not possible for
-  // other types)
+  // other types), holes of polygons end in a different one
   if (isArea) {
-    util::geo::Point<int16_t> p{mCoord(0), mCoord(0)};
-    _linePointsF.write(reinterpret_cast<const char *>(&p),
-                       sizeof(util::geo::Point<int16_t>));
-    _linePointsFSize++;
+    util::geo::Point<int16_t> p{mCoord(0), mCoord(isHole ? 1 : 0)};
+    batch->linePoints.push_back(p);
   }
 }
 
 // _____________________________________________________________________________
-util::geo::DBox GeomCache::getLineBBox(size_t lid) const {
-  util::geo::DBox ret;
-  size_t start = getLine(lid);
+std::string GeomCache::indexHashFromDisk(const std::string &fname) {
+  std::ifstream f(fname, std::ios::binary);
 
-  bool s = false;
+  CacheHeader h;
+  f.read(reinterpret_cast<char *>(&h), sizeof(h));
 
-  double mainX = 0;
-  double mainY = 0;
-  for (size_t i = start; i < start + 4; i++) {
-    // extract real geom
-    const auto &cur = _linePoints[i];
+  if (f && memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) == 0) {
+    // unknown versions are treated as a missing cache file
+    if (h.version < CACHE_MIN_VERSION || h.version > CACHE_VERSION) return "";
+    h.indexHash[CACHE_HASH_SIZE - 1] = 0;
+    return util::trim(h.indexHash);
+  }
 
-    if (isMCoord(cur.getX())) {
-      mainX = rmCoord(cur.getX());
-      mainY = rmCoord(cur.getY());
-      continue;
-    }
+  // legacy format, prefixed by the 100 byte index hash
+  f.clear();
+  f.seekg(0);
+  char tmp[CACHE_HASH_SIZE];
+  f.read(tmp, CACHE_HASH_SIZE);
+  tmp[CACHE_HASH_SIZE - 1] = 0;
 
-    util::geo::DPoint curP((mainX * M_COORD_GRANULARITY + cur.getX()) / 10.0,
-                           (mainY * M_COORD_GRANULARITY + cur.getY()) / 10.0);
+  return util::trim(tmp);
+}
 
-    if (!s) {
-      ret.setLowerLeft(curP);
-      s = true;
-    } else {
-      ret.setUpperRight(curP);
-      return ret;
-    }
+// _____________________________________________________________________________
+bool GeomCache::hasFingerprints(const std::string &fname) {
+  std::ifstream f(fname, std::ios::binary);
+
+  CacheHeader h;
+  f.read(reinterpret_cast<char *>(&h), sizeof(h));
+
+  if (!f || memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) != 0 ||
+      h.version < CACHE_MD5_VERSION || h.version > CACHE_VERSION ||
+      h.numSections > CACHE_MAX_SECTIONS)
+    return false;
+
+  for (size_t i = 0; i < h.numSections; i++) {
+    if (h.sections[i].id == CACHE_SEC_FINGERPRINTS && h.sections[i].num > 0)
+      return true;
   }
 
-  return ret;
+  return false;
 }
 
 // _____________________________________________________________________________
-std::string GeomCache::indexHashFromDisk(const std::string &fname) {
-  std::ifstream f(fname, std::ios::binary);
-  char tmp[100];
-  f.read(tmp, 100);
-  tmp[99] = 0;
-
-  return util::trim(tmp);
+template <typename T>
+void GeomCache::mapSection(int fd, const CacheSection &s,
+                           MappedArray<T> *arr) {
+  if (s.elemSize != sizeof(T)) {
+    throw std::runtime_error("Unexpected element size in cache file");
+  }
+  arr->mapFile(fd, s.offset, s.num);
 }
 
 // _____________________________________________________________________________
-void GeomCache::fromDisk(const std::string &fname) {
+void GeomCache::fromDisk(const std::string &fname, bool migrate) {
   _loadStatusStage = _LoadStatusStages::FromFile;
-  _points.clear();
-  _linePoints.clear();
-  _lines.clear();
+  _points.free();
+  _linePoints.free();
+  _lineBytes.free();
+  _linesCompressed = false;
+  _lines.free();
+  _lineLods.free();
+  _lods.free();
+  _lodPoints.free();
+  _qidToId.free();
+  _fingerprints.free();
+  _fingerprintIds.free();
+
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd == -1) throw std::runtime_error("Could not open cache file " + fname);
+
+  CacheHeader h;
+  struct stat st;
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+      memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) != 0) {
+    close(fd);
+
+    fromLegacyDisk(fname);
+    if (!migrate) return;
+    buildLods();
+
+    // the legacy file stays usable if it cannot be replaced
+    LOG(INFO) << "[GEOMCACHE] Migrating cache file " << fname
+              << " to version " << CACHE_VERSION << "...";
+    try {
+      serializeToDisk(fname);
+    } catch (const std::exception &e) {
+      LOG(WARN) << "[GEOMCACHE] " << e.what();
+    }
+    return;
+  }
+
+  try {
+    if (h.version < CACHE_MIN_VERSION || h.version > CACHE_VERSION) {
+      throw std::runtime_error("Unsupported cache file version");
+    }
+
+    if (fstat(fd, &st) == -1 || h.numSections > CACHE_MAX_SECTIONS) {
+      throw std::runtime_error("Invalid cache file header");
+    }
+
+    h.indexHash[CACHE_HASH_SIZE - 1] = 0;
+    _indexHash = util::trim(h.indexHash);
+
+    _totalSize = 0;
+
+    MappedArray<size_t> plainLines;
+
+    for (size_t i = 0; i < h.numSections; i++) {
+      const auto &sec = h.sections[i];
+      if (sec.offset % CACHE_ALIGN != 0 ||
+          sec.offset + sec.elemSize * sec.num >
+              static_cast<uint64_t>(st.st_size)) {
+        throw std::runtime_error("Invalid section in cache file");
+      }
+
+      switch (sec.id) {
+        case CACHE_SEC_POINTS:
+          mapSection(fd, sec, &_points);
+          break;
+        case CACHE_SEC_LINE_POINTS:
+          mapSection(fd, sec, &_linePoints);
+          break;
+        case CACHE_SEC_LINES:
+          // version 2, converted to an offset index below
+          mapSection(fd, sec, &plainLines);
+          break;
+        case CACHE_SEC_LINE_OFFSETS:
+          mapSection(fd, sec, &_lines.offsets());
+          break;
+        case CACHE_SEC_LINE_BASES:
+          mapSection(fd, sec, &_lines.bases());
+          break;
+        case CACHE_SEC_QID_TO_ID:
+          mapSection(fd, sec, &_qidToId);
+          break;
+        case CACHE_SEC_FINGERPRINTS:
+          if (h.version >= CACHE_MD5_VERSION) {
+            mapSection(fd, sec, &_fingerprints);
+          }
+          break;
+        case CACHE_SEC_FINGERPRINT_IDS:
+          if (h.version >= CACHE_MD5_VERSION) {
+            mapSection(fd, sec, &_fingerprintIds);
+          }
+          break;
+        case CACHE_SEC_LINE_LODS:
+          mapSection(fd, sec, &_lineLods);
+          break;
+        case CACHE_SEC_LODS:
+          mapSection(fd, sec, &_lods);
+          break;
+        case CACHE_SEC_LOD_POINTS:
+          mapSection(fd, sec, &_lodPoints);
+          break;
+        default:
+          // sections unknown to this version are skipped
+          break;
+      }
+
+      _totalSize += sec.num;
+    }
+
+    for (size_t off : plainLines) _lines.push_back(off);
+
+    if (!_lines.valid()) {
+      throw std::runtime_error("Invalid line offsets in cache file");
+    }
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+
+  // the mappings remain valid after closing
+  close(fd);
 
+  _curRow = _totalSize;
+
+  // cache files written before the levels of detail existed, they are
+  // built before the file is migrated so that they are stored
+  if (!migrate) return;
+  bool noLods = _lineLods.size() != _lines.size();
+  if (noLods) buildLods();
+
+  if (h.version < CACHE_VERSION || noLods) {
+    LOG(INFO) << "[GEOMCACHE] Migrating cache file " << fname
+              << " to version " << CACHE_VERSION << "...";
+    try {
+      serializeToDisk(fname);
+    } catch (const std::exception &e) {
+      LOG(WARN) << "[GEOMCACHE] " << e.what();
+    }
+  }
+}
+
+// _____________________________________________________________________________
+void GeomCache::fromLegacyDisk(const std::string &fname) {
   std::ifstream f(fname, std::ios::binary);
 
   // load hash
-  char tmp[100];
-  f.read(tmp, 100);
-  tmp[99] = 0;
+  char tmp[CACHE_HASH_SIZE];
+  f.read(tmp, CACHE_HASH_SIZE);
+  tmp[CACHE_HASH_SIZE - 1] = 0;
   _indexHash = util::trim(tmp);
 
   size_t numPoints;
@@ -1083,7 +2637,7 @@ void GeomCache::fromDisk(const std::string &fname) {
 
   // lines
   f.read(reinterpret_cast<char *>(&numLines), sizeof(size_t));
-  _lines.resize(numLines);
+  std::vector<size_t> lines(numLines);
   posLines = f.tellg();
   f.seekg(sizeof(size_t) * numLines, f.cur);
 
@@ -1097,91 +2651,132 @@ void GeomCache::fromDisk(const std::string &fname) {
   _curRow = 0;
 
   // read data from file
-  // points
   f.seekg(posPoints);
-  for (size_t i = 0; i < numPoints; i++) {
-    f.read(reinterpret_cast<char *>(&_points[i]), sizeof(util::geo::FPoint));
-    _curRow += 1;
-  }
+  f.read(reinterpret_cast<char *>(_points.data()),
+         sizeof(util::geo::FPoint) * numPoints);
+  _curRow += numPoints;
 
-  // linePoints
   f.seekg(posLinePoints);
-  for (size_t i = 0; i < numLinePoints; i++) {
-    f.read(reinterpret_cast<char *>(&_linePoints[i]),
-           sizeof(util::geo::Point<int16_t>));
-    _curRow += 1;
-  }
+  f.read(reinterpret_cast<char *>(_linePoints.data()),
+         sizeof(util::geo::Point<int16_t>) * numLinePoints);
+  _curRow += numLinePoints;
 
-  // lines
   f.seekg(posLines);
-  for (size_t i = 0; i < numLines; i++) {
-    f.read(reinterpret_cast<char *>(&_lines[i]), sizeof(size_t));
-    _curRow += 1;
-  }
+  f.read(reinterpret_cast<char *>(lines.data()), sizeof(size_t) * numLines);
+  for (size_t off : lines) _lines.push_back(off);
+  _curRow += numLines;
 
-  // qidToId
   f.seekg(posQidToId);
-  for (size_t i = 0; i < numQidToId; i++) {
-    f.read(reinterpret_cast<char *>(&_qidToId[i]), sizeof(IdMapping));
-    _curRow += 1;
-  }
+  f.read(reinterpret_cast<char *>(_qidToId.data()),
+         sizeof(IdMapping) * numQidToId);
+  _curRow += numQidToId;
+
+  if (!f) throw std::runtime_error("Could not read cache file " + fname);
 
   f.close();
 }
 
 // _____________________________________________________________________________
 void GeomCache::serializeToDisk(const std::string &fname) const {
-  std::ofstream f;
-  f.open(fname);
-
-  std::string h = _indexHash;
-  h.insert(h.end(), 99 - h.size(), ' ');
-
-  // null byte is 100
-  assert(h.size() == 99);
-  f.write(h.c_str(), 100);
-
-  size_t num = _points.size();
-  f.write(reinterpret_cast<const char *>(&num), sizeof(size_t));
-  f.write(reinterpret_cast<const char *>(&_points[0]),
-          sizeof(util::geo::FPoint) * num);
-
-  num = _linePoints.size();
-  f.write(reinterpret_cast<const char *>(&num), sizeof(size_t));
-  f.write(reinterpret_cast<const char *>(&_linePoints[0]),
-          sizeof(util::geo::Point<int16_t>) * num);
+  CacheHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+  h.version = CACHE_VERSION;
+  strncpy(h.indexHash, _indexHash.c_str(), CACHE_HASH_SIZE - 1);
+
+  std::vector<const char *> data;
+
+  auto addSection = [&h, &data](uint32_t id, const char *d, size_t elemSize,
+                                size_t num) {
+    CacheSection &sec = h.sections[h.numSections++];
+    sec.id = id;
+    sec.elemSize = elemSize;
+    sec.num = num;
+    data.push_back(d);
+  };
 
-  num = _lines.size();
-  f.write(reinterpret_cast<const char *>(&num), sizeof(size_t));
-  f.write(reinterpret_cast<const char *>(&_lines[0]), sizeof(size_t) * num);
+  addSection(CACHE_SEC_POINTS, reinterpret_cast<const char *>(_points.data()),
+             sizeof(util::geo::FPoint), _points.size());
+  addSection(CACHE_SEC_LINE_POINTS,
+             reinterpret_cast<const char *>(_linePoints.data()),
+             sizeof(util::geo::Point<int16_t>), _linePoints.size());
+  addSection(CACHE_SEC_LINE_OFFSETS,
+             reinterpret_cast<const char *>(_lines.offsets().data()),
+             sizeof(uint32_t), _lines.offsets().size());
+  addSection(CACHE_SEC_LINE_BASES,
+             reinterpret_cast<const char *>(_lines.bases().data()),
+             sizeof(size_t), _lines.bases().size());
+  addSection(CACHE_SEC_QID_TO_ID,
+             reinterpret_cast<const char *>(_qidToId.data()),
+             sizeof(IdMapping), _qidToId.size());
+  addSection(CACHE_SEC_FINGERPRINTS,
+             reinterpret_cast<const char *>(_fingerprints.data()),
+             sizeof(GeomFingerprint), _fingerprints.size());
+  addSection(CACHE_SEC_FINGERPRINT_IDS,
+             reinterpret_cast<const char *>(_fingerprintIds.data()),
+             sizeof(ID_TYPE), _fingerprintIds.size());
+  addSection(CACHE_SEC_LINE_LODS,
+             reinterpret_cast<const char *>(_lineLods.data()),
+             sizeof(uint32_t), _lineLods.size());
+  addSection(CACHE_SEC_LODS, reinterpret_cast<const char *>(_lods.data()),
+             sizeof(size_t), _lods.size());
+  addSection(CACHE_SEC_LOD_POINTS,
+             reinterpret_cast<const char *>(_lodPoints.data()),
+             sizeof(util::geo::Point<int16_t>), _lodPoints.size());
+
+  // each section starts at an offset that can be mapped directly
+  size_t off = sizeof(h);
+  for (size_t i = 0; i < h.numSections; i++) {
+    off = ((off + CACHE_ALIGN - 1) / CACHE_ALIGN) * CACHE_ALIGN;
+    h.sections[i].offset = off;
+    off += h.sections[i].elemSize * h.sections[i].num;
+  }
 
-  num = _qidToId.size();
-  f.write(reinterpret_cast<const char *>(&num), sizeof(size_t));
-  f.write(reinterpret_cast<const char *>(&_qidToId[0]),
-          sizeof(IdMapping) * num);
+  // write to a temporary file first, so that a concurrent reader (or a
+  // mapping of the previous file) never sees a partially written file
+  std::string tmpName = fname + ".tmp";
+  std::ofstream f(tmpName, std::ios::binary | std::ios::trunc);
+
+  f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+  size_t pos = sizeof(h);
+  std::string padding;
+  for (size_t i = 0; i < h.numSections; i++) {
+    const auto &sec = h.sections[i];
+    padding.assign(sec.offset - pos, 0);
+    f.write(padding.c_str(), padding.size());
+    f.write(data[i], sec.elemSize * sec.num);
+    pos = sec.offset + sec.elemSize * sec.num;
+  }
 
   f.close();
+
+  if (!f || rename(tmpName.c_str(), fname.c_str()) != 0) {
+    unlink(tmpName.c_str());
+    throw std::runtime_error("Could not write cache file " + fname);
+  }
 }
 
 // _____________________________________________________________________________
-std::string GeomCache::requestIndexHash() {
+std::string GeomCache::requestIndexHash(CURL *curl,
+                                        const std::string &backendUrl) const {
   CURLcode res;
   char errbuf[CURL_ERROR_SIZE];
   std::string response;
 
-  if (_curl) {
-    std::string url = _backendUrl + "/?cmd=get-index-id";
-    curl_easy_setopt(_curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, GeomCache::writeCbString);
-    curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(_curl, CURLOPT_ERRORBUFFER, errbuf);
-    curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYPEER, false);
-    curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYHOST, false);
-    curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, 0);
+  if (curl) {
+    std::string url = backendUrl + "/?cmd=get-index-id";
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, GeomCache::writeCbString);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, 0);
 
     // accept any compression supported
-    curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, "");
-    res = curl_easy_perform(_curl);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    res = curl_easy_perform(curl);
 
     if (res != CURLE_OK) {
       size_t len = strlen(errbuf);
@@ -1195,7 +2790,7 @@ std::string GeomCache::requestIndexHash() {
     }
 
     long httpCode = 0;
-    curl_easy_getinfo(_curl, CURLINFO_RESPONSE_CODE, &httpCode);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
 
     if (httpCode != 200) {
       LOG(WARN) << "QLever backend returned status code " << httpCode
@@ -1211,11 +2806,85 @@ std::string GeomCache::requestIndexHash() {
 }
 
 // _____________________________________________________________________________
-std::string GeomCache::load(const std::string &cacheDir) {
+std::string GeomCache::getIdentity(const std::string &indexHash) const {
+  return getIdentity(indexHash, _backendUrl);
+}
+
+// _____________________________________________________________________________
+std::string GeomCache::getIdentity(const std::string &indexHash,
+                                   const std::string &backendUrl) const {
+  if (indexHash.empty()) return "";
+  return indexHash + "$" + getQuery(backendUrl);
+}
+
+// _____________________________________________________________________________
+std::string GeomCache::requestIndexHash(const std::string &backendUrl) const {
+  // own handle, _curl may be in use by a concurrent load()
+  CURL *curl = curl_easy_init();
+  auto indexHash = requestIndexHash(curl, backendUrl);
+  if (curl) curl_easy_cleanup(curl);
+  return indexHash;
+}
+
+// _____________________________________________________________________________
+std::string GeomCache::cacheFileName(const std::string &indexHash) const {
+  auto id = getIdentity(indexHash);
+
+  if (id.empty()) {
+    // without an index hash, the file is named after the backend URL
+    std::string backend = getBackendURL();
+    util::replaceAll(backend, "/", "_");
+    return backend;
+  }
+
+  // readable prefix of the index hash, and a hash of the full identity
+  std::string name;
+  for (char c : indexHash.substr(0, 64)) {
+    name += isalnum(c) || c == '-' || c == '.' ? c : '_';
+  }
+
+  uint64_t hash;
+  uint32_t check;
+  wktFingerprint(id.c_str(), id.size(), &hash, &check);
+
+  std::stringstream ss;
+  ss << name << "_" << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ss.str();
+}
+
+// _____________________________________________________________________________
+static std::string resolveCacheLink(const std::string &dir,
+                                    const std::string &fname) {
+  // the file the link fname (relative to dir) points to, or fname itself if
+  // it is no link
+  char buf[4096];
+  ssize_t len = readlink(fname.c_str(), buf, sizeof(buf) - 1);
+  if (len <= 0) return fname;
+  buf[len] = 0;
+  return dir + "/" + buf;
+}
+
+// _____________________________________________________________________________
+static void linkCacheFile(const std::string &link, const std::string &name) {
+  // atomically replace link by a link to name
+  std::string tmp = link + ".tmp";
+  unlink(tmp.c_str());
+  if (symlink(name.c_str(), tmp.c_str()) != 0 ||
+      rename(tmp.c_str(), link.c_str()) != 0) {
+    unlink(tmp.c_str());
+    LOG(WARN) << "[GEOMCACHE] Could not link " << link << " to " << name;
+  }
+}
+
+// _____________________________________________________________________________
+std::string GeomCache::load(const std::string &cacheDir,
+                            const std::string &indexHash) {
   std::lock_guard<std::mutex> guard(_m);
 
+  // the row fingerprints are only read again from a cache file
+  _keepFingerprints = cacheDir.size() > 0;
+
   if (_ready) {
-    auto indexHash = requestIndexHash();
     if (_indexHash == indexHash) return _indexHash;
     LOG(INFO) << "Loaded index hash (" << _indexHash
               << ") and remote index hash (" << indexHash << ") dont match.";
@@ -1223,36 +2892,111 @@ std::string GeomCache::load(const std::string &cacheDir) {
   }
 
   if (cacheDir.size()) {
+    // cache files are named after the identity of the geometries, so that
+    // backends serving the same index share one
+    std::string name = cacheFileName(indexHash);
+    std::string cacheFile = cacheDir + "/" + name;
+
+    // a link named after the backend URL points to the cache file of the
+    // backend (earlier versions stored the cache file itself under this name)
     std::string backend = getBackendURL();
     util::replaceAll(backend, "/", "_");
-    std::string cacheFile = cacheDir + "/" + backend;
-    auto indexHash = requestIndexHash();
-    if (access(cacheFile.c_str(), F_OK) != -1 &&
-        indexHash == indexHashFromDisk(cacheFile)) {
-      LOG(INFO) << "Reading from cache file " << cacheFile << "...";
-      fromDisk(cacheFile);
-      LOG(INFO) << "done ...";
-    } else {
-      if (access(cacheDir.c_str(), W_OK) != 0) {
-        std::stringstream ss;
-        ss << "No write access to cache dir " << cacheDir;
-        throw std::runtime_error(ss.str());
+    std::string urlFile = cacheDir + "/" + backend;
+
+    // the previous cache file of this backend, of an older index or written
+    // by an earlier version, may be re-used
+    std::string prevFile = _cacheFile;
+    if (prevFile.empty()) prevFile = resolveCacheLink(cacheDir, urlFile);
+
+    std::string readFile = cacheFile;
+    if (access(cacheFile.c_str(), F_OK) == -1) readFile = prevFile;
+
+    bool exists = access(readFile.c_str(), F_OK) != -1;
+    if (exists && indexHash == indexHashFromDisk(readFile)) {
+      LOG(INFO) << "Reading from cache file " << readFile << "...";
+      try {
+        fromDisk(readFile);
+        if (readFile != cacheFile &&
+            rename(readFile.c_str(), cacheFile.c_str()) == 0) {
+          LOG(INFO) << "Renamed cache file " << readFile << " to "
+                    << cacheFile;
+          readFile = cacheFile;
+        }
+        _cacheFile = readFile;
+        if (readFile == cacheFile && urlFile != cacheFile) {
+          linkCacheFile(urlFile, name);
+        }
+        LOG(INFO) << "done ...";
+        if (_compressLines) compressLines();
+        // a refresh reads the fingerprints from the cache file again
+        _fingerprints.free();
+        _fingerprintIds.free();
+        _ready = true;
+        return _indexHash;
+      } catch (const std::exception &e) {
+        LOG(WARN) << "Could not read cache file " << readFile << ": "
+                  << e.what() << ", rebuilding it...";
+      }
+    } else if (exists && _fingerprints.empty() &&
+               hasFingerprints(readFile)) {
+      // an outdated cache file still holds the geometries of all rows whose
+      // WKT did not change, they are re-used by the refresh below
+      LOG(INFO) << "Reading outdated cache file " << readFile
+                << " for an incremental refresh...";
+      try {
+        fromDisk(readFile, false);
+      } catch (const std::exception &e) {
+        LOG(WARN) << "Could not read cache file " << readFile << ": "
+                  << e.what();
+        _fingerprints.free();
       }
-      _indexHash = requestIndexHash();
-      LOG(INFO) << "Index hash is '" << _indexHash << "'";
-      request();
-      requestIds();
-      LOG(INFO) << "Serializing to cache file " << cacheFile << "...";
-      serializeToDisk(cacheFile);
-      LOG(INFO) << "done ...";
     }
+
+    if (access(cacheDir.c_str(), W_OK) != 0) {
+      std::stringstream ss;
+      ss << "No write access to cache dir " << cacheDir;
+      throw std::runtime_error(ss.str());
+    }
+    _indexHash = indexHash;
+    LOG(INFO) << "Index hash is '" << _indexHash << "'";
+    request();
+    requestIds();
+    LOG(INFO) << "Serializing to cache file " << cacheFile << "...";
+    serializeToDisk(cacheFile);
+    LOG(INFO) << "done ...";
+
+    // only needed by the next refresh, which reads them from the cache file
+    _fingerprints.free();
+    _fingerprintIds.free();
+
+    // the previous cache file of this backend is outdated now
+    if (prevFile != cacheFile && access(prevFile.c_str(), F_OK) != -1) {
+      LOG(INFO) << "Removing outdated cache file " << prevFile;
+      unlink(prevFile.c_str());
+    }
+    _cacheFile = cacheFile;
+    if (urlFile != cacheFile) linkCacheFile(urlFile, name);
   } else {
-    _indexHash = requestIndexHash();
+    _indexHash = indexHash;
     LOG(INFO) << "Index hash is '" << _indexHash << "'";
     request();
     requestIds();
   }
 
+  if (_compressLines) compressLines();
+
   _ready = true;
   return _indexHash;
 }
+
+// _____________________________________________________________________________
+size_t GeomCache::getMemSize() const {
+  return _points.size() * sizeof(util::geo::FPoint) +
+         _linePoints.size() * sizeof(util::geo::Point<int16_t>) +
+         _lines.bytes() + _lineBytes.size() +
+         _lineLods.size() * sizeof(uint32_t) + _lods.size() * sizeof(size_t) +
+         _lodPoints.size() * sizeof(util::geo::Point<int16_t>) +
+         _qidToId.size() * sizeof(IdMapping) +
+         _fingerprints.size() * sizeof(GeomFingerprint) +
+         _fingerprintIds.size() * sizeof(ID_TYPE);
+}
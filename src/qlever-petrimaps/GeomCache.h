@@ -7,31 +7,195 @@
 
 #include <curl/curl.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <limits>
 #include <map>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
-#include <atomic>
 
+#include "qlever-petrimaps/LineCodec.h"
+#include "qlever-petrimaps/MappedArray.h"
 #include "qlever-petrimaps/Misc.h"
+#include "qlever-petrimaps/OffsetIndex.h"
 #include "util/geo/Geo.h"
 
 namespace petrimaps {
 
+// Fingerprint of the WKT of a row (the leading 96 bits of the MD5 digest of
+// its lexical form, as returned by the MD5() of the backend), and the ids of
+// the geometries parsed from it. ids is an offset into the fingerprint id
+// list, which holds num ids for this row.
+struct GeomFingerprint {
+  uint64_t hash;
+  uint32_t check;
+  uint32_t num;
+  uint64_t ids;
+
+  bool operator<(const GeomFingerprint& o) const {
+    return hash < o.hash || (hash == o.hash && check < o.check);
+  }
+};
+
+// A row of a parse batch with its WKT fingerprint, qidIdx is the position of
+// its first entry in the batch's qidToId
+struct RowFingerprint {
+  size_t qidIdx;
+  uint64_t hash;
+  uint32_t check;
+};
+
+// A batch of complete rows of the fill query, parsed independently of all
+// other batches. Geometry ids and line offsets are local to the batch and
+// are rebased when the batch is stitched into the cache.
+struct ParseBatch {
+  size_t part = 0;
+  size_t seq = 0;
+
+  // the rows of the batch, or, if end is set, the rows [begin, end) of a
+  // curl buffer, which are parsed before its write callback returns
+  std::string rows;
+  const char* begin = 0;
+  const char* end = 0;
+
+  std::vector<util::geo::FPoint> points;
+  std::vector<util::geo::Point<int16_t>> linePoints;
+  std::vector<size_t> lines;
+  std::vector<IdMapping> qidToId;
+
+  // fingerprints of the points and lines, for the deduplication
+  std::vector<uint32_t> pointHashes;
+  std::vector<uint32_t> lineHashes;
+
+  // WKT fingerprints of the rows, for later incremental refreshes
+  std::vector<RowFingerprint> rowFingerprints;
+
+  size_t numRows = 0;
+  size_t uniqueGeoms = 0;
+  size_t refreshedGeoms = 0;
+};
+
+// Cache file layout (version 4): a CacheHeader, followed by the sections
+// listed in it. Each section starts at a multiple of CACHE_ALIGN, so that it
+// can be mapped into memory directly. Version 2 files, which hold the line
+// offsets as a plain CACHE_SEC_LINES section, can still be read. The row
+// fingerprints of files before CACHE_MD5_VERSION use another hash and are
+// ignored.
+static const char CACHE_MAGIC[8] = {'P', 'M', 'C', 'A', 'C', 'H', 'E', 0};
+static const uint32_t CACHE_VERSION = 4;
+static const uint32_t CACHE_MD5_VERSION = 4;
+static const uint32_t CACHE_MIN_VERSION = 2;
+static const size_t CACHE_ALIGN = 1 << 16;
+static const size_t CACHE_HASH_SIZE = 100;
+static const size_t CACHE_MAX_SECTIONS = 32;
+
+enum CacheSectionId : uint32_t {
+  CACHE_SEC_POINTS = 1,
+  CACHE_SEC_LINE_POINTS = 2,
+  CACHE_SEC_LINES = 3,
+  CACHE_SEC_QID_TO_ID = 4,
+  CACHE_SEC_FINGERPRINTS = 5,
+  CACHE_SEC_FINGERPRINT_IDS = 6,
+  CACHE_SEC_LINE_LODS = 7,
+  CACHE_SEC_LODS = 8,
+  CACHE_SEC_LOD_POINTS = 9,
+  CACHE_SEC_LINE_OFFSETS = 10,
+  CACHE_SEC_LINE_BASES = 11
+};
+
+struct CacheSection {
+  uint32_t id;
+  uint32_t elemSize;
+  uint64_t offset;
+  uint64_t num;
+};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numSections;
+  char indexHash[CACHE_HASH_SIZE];
+  CacheSection sections[CACHE_MAX_SECTIONS];
+};
+
+// Levels of detail of the lines: Douglas-Peucker simplifications with these
+// tolerances (in web mercator meters) are precomputed for all lines with at
+// least LOD_MIN_POINTS vertices.
+static const size_t LOD_LEVELS = 4;
+static const double LOD_EPS[LOD_LEVELS] = {10, 40, 160, 640};
+static const size_t LOD_MIN_POINTS = 16;
+static const uint32_t LOD_NONE = std::numeric_limits<uint32_t>::max();
+
+// a row of an incremental refresh without a fingerprint of the previous fill
+static const size_t FINGERPRINT_NONE = std::numeric_limits<size_t>::max();
+
+class GeomCache;
+
+// A window of the fill query. Several windows are fetched concurrently, each
+// with its own curl handle and its own partial rows.
+struct FillPart {
+  FillPart(GeomCache* cache, size_t part, size_t offset)
+      : cache(cache), part(part), offset(offset), curl(curl_easy_init()) {
+    errbuf[0] = 0;
+  }
+  ~FillPart() {
+    if (headers) curl_slist_free_all(headers);
+    if (curl) curl_easy_cleanup(curl);
+  }
+
+  GeomCache* cache;
+  size_t part;
+  size_t offset;
+
+  CURL* curl;
+  struct curl_slist* headers = 0;
+  char errbuf[CURL_ERROR_SIZE];
+
+  ParseState state = IN_HEADER;
+  std::string dangling, raw;
+  size_t numBatches = 0;
+  size_t numRows = 0;
+
+  // during an incremental refresh, the window first fetches the MD5 hashes
+  // of its rows. known holds for each row the index of its fingerprint in
+  // the previous fill, or FINGERPRINT_NONE, only the WKT of the rows without
+  // one is fetched afterwards.
+  bool hashes = false;
+  std::vector<size_t> known;
+
+  std::exception_ptr exceptionPtr;
+};
+
 class GeomCache {
  public:
   GeomCache() : _backendUrl(""), _curl(0) {}
-  explicit GeomCache(const std::string& backendUrl)
+  explicit GeomCache(const std::string& backendUrl, size_t fillRequests = 4,
+                     bool compressLines = false, bool hilbertOrder = false)
       : _backendUrl(backendUrl),
-        _curl(curl_easy_init()) {}
+        _curl(curl_easy_init()),
+        _fillRequests(fillRequests),
+        _compressLines(compressLines),
+        _hilbertOrder(hilbertOrder) {}
 
   GeomCache& operator=(GeomCache&& o) {
     _backendUrl = o._backendUrl;
+    _fillRequests = o._fillRequests;
+    _compressLines = o._compressLines;
+    _hilbertOrder = o._hilbertOrder;
     _curl = curl_easy_init();
     _lines = std::move(o._lines);
     _linePoints = std::move(o._linePoints);
+    _lineBytes = std::move(o._lineBytes);
+    _linesCompressed = o._linesCompressed;
+    _lineLods = std::move(o._lineLods);
+    _lods = std::move(o._lods);
+    _lodPoints = std::move(o._lodPoints);
     _points = std::move(o._points);
     _dangling = o._dangling;
     _state = o._state;
@@ -49,45 +213,96 @@ class GeomCache {
     return ready;
   }
 
-  std::string load(const std::string& cacheFile);
+  // the index hash of the loaded geometries, empty if not ready. Waits for
+  // a running load().
+  std::string getIndexHash() const {
+    std::lock_guard<std::mutex> guard(_m);
+    return _ready ? _indexHash : "";
+  }
+
+  // loads the geometries for indexHash, the current index hash of the
+  // backend as given by requestIndexHash(), returns the loaded index hash
+  std::string load(const std::string& cacheDir, const std::string& indexHash);
 
   void request();
   size_t requestSize();
-  void requestPart(size_t offset);
 
   void requestIds();
 
-  void parse(const char*, size_t size);
+  void parse(FillPart* part, const char*, size_t size);
   void parseIds(const char*, size_t size);
   void parseCount(const char*, size_t size);
 
-  std::pair<std::vector<std::pair<ID_TYPE, ID_TYPE>>, size_t> getRelObjects(
-      const std::vector<IdMapping>& id) const;
+  // joins the ids (sorted by qid) with the geometries, writes (geom id,
+  // result row) pairs to ret and returns the number of objects, counting
+  // multi-geometries once. The ret->size() pairs are charged to memory, if
+  // given, before they are allocated.
+  size_t getRelObjects(const std::vector<IdMapping>& ids,
+                       std::vector<std::pair<ID_TYPE, ID_TYPE>>* ret,
+                       MemoryBudget* memory) const;
+
+  // the size of the loaded geometries and id mappings, in bytes
+  size_t getMemSize() const;
 
   const std::string& getBackendURL() const { return _backendUrl; }
 
-  const std::vector<util::geo::FPoint>& getPoints() const { return _points; }
+  // the identity of the geometries of the backend, the index hash plus the
+  // fill query, empty if the index hash is unknown. Backends with the same
+  // identity serve the same geometries.
+  std::string getIdentity(const std::string& indexHash) const;
+  std::string getIdentity(const std::string& indexHash,
+                          const std::string& backendUrl) const;
 
-  const std::vector<util::geo::Point<int16_t>>& getLinePoints() const {
-    return _linePoints;
+  // requests the current index hash of the given backend, which may be
+  // another one than the backend of this cache
+  std::string requestIndexHash(const std::string& backendUrl) const;
+
+  const MappedArray<util::geo::FPoint>& getPoints() const { return _points; }
+
+  // reader for the bounding box and the vertices of a line
+  LineReader getLineReader(ID_TYPE id) const {
+    if (_linesCompressed) return LineReader(_lineBytes.data() + _lines[id]);
+    return LineReader(_linePoints.data() + _lines[id],
+                      _linePoints.data() + getLineEnd(id));
+  }
+
+  // reader for the coarsest level of detail of a line whose tolerance is at
+  // most eps, or for the full line
+  LineReader getLineReader(ID_TYPE id, double eps) const {
+    if (id < _lineLods.size() && _lineLods[id] != LOD_NONE) {
+      const size_t* o = &_lods[_lineLods[id] * (LOD_LEVELS + 1)];
+      for (size_t k = LOD_LEVELS; k > 0; k--) {
+        // empty levels fall back to the next finer one
+        if (LOD_EPS[k - 1] > eps || o[k - 1] == o[k]) continue;
+        return LineReader(_lodPoints.data() + o[k - 1],
+                          _lodPoints.data() + o[k]);
+      }
+    }
+    return getLineReader(id);
   }
 
-  const std::vector<size_t>& getLines() const { return _lines; }
+  // LINE_AREA and LINE_HOLE flags of a line
+  uint8_t getLineFlags(ID_TYPE id) const {
+    if (_linesCompressed) {
+      uint32_t v;
+      lineReadVarint(_lineBytes.data() + _lines[id], &v);
+      return v & 3;
+    }
+    return lineFlags(_linePoints.data() + getLineEnd(id));
+  }
 
   util::geo::FBox getPointBBox(size_t id) const {
     return util::geo::getBoundingBox(_points[id]);
   }
-  util::geo::DBox getLineBBox(size_t id) const;
+  util::geo::DBox getLineBBox(size_t id) const {
+    return getLineReader(id).getBBox();
+  }
 
   void serializeToDisk(const std::string& fname) const;
 
-  void fromDisk(const std::string& fname);
-
-  size_t getLine(ID_TYPE id) const { return _lines[id]; }
-
-  size_t getLineEnd(ID_TYPE id) const {
-    return id + 1 < _lines.size() ? _lines[id + 1] : _linePoints.size();
-  }
+  // reads the cache file fname. If migrate, a file of an earlier version is
+  // completed and rewritten in the current version.
+  void fromDisk(const std::string& fname, bool migrate = true);
 
   double getLoadStatusPercent(bool total);
   double getLoadStatusPercent() { return getLoadStatusPercent(false); };
@@ -99,8 +314,25 @@ class GeomCache {
   std::string _backendUrl;
   CURL* _curl;
 
+  // number of fill query windows requested concurrently
+  size_t _fillRequests = 1;
+
+  // keep the row fingerprints for the next refresh, only with a cache dir
+  bool _keepFingerprints = false;
+
+  // fetch the MD5 hashes of the rows first during an incremental refresh
+  bool _hashRefresh = false;
+  size_t _refreshRows = 0;
+
+  // keep the line points compressed in memory after loading
+  bool _compressLines = false;
+
+  // renumber the geometries along a Hilbert curve after a fill
+  bool _hilbertOrder = false;
+
   uint8_t _curByte;
   ID _curId;
+  uint64_t _lastQid;
   QLEVER_ID_TYPE _maxQid;
   size_t _totalSize = 0;
   std::atomic<size_t> _curRow;
@@ -109,6 +341,28 @@ class GeomCache {
   enum _LoadStatusStages {Parse = 1, ParseIds, FromFile};
   _LoadStatusStages _loadStatusStage = Parse;
 
+  // rows are handed to the parse workers in batches of roughly this size
+  static const size_t PARSE_BATCH_SIZE = 1 << 22;
+
+  // the rows of a curl buffer are parsed in place, split into at most one
+  // batch per parse worker, but of at least this size
+  static const size_t PARSE_MIN_BATCH_SIZE = 1 << 12;
+
+  // number of rows requested per window of the fill query
+  static const size_t FILL_WINDOW = 1000000;
+
+  // during a refresh, runs of changed rows with gaps of at most REFRESH_GAP
+  // known rows are fetched with one request, with at most REFRESH_MAX_RUNS
+  // requests per window
+  static const size_t REFRESH_GAP = 64;
+  static const size_t REFRESH_MAX_RUNS = 1024;
+
+  // minimum number of ids per partition of the join in getRelObjects
+  static const size_t JOIN_MIN_PART = 1 << 16;
+
+  // minimum number of lines per thread when building the levels of detail
+  static const size_t LOD_MIN_PART = 1 << 14;
+
   static size_t writeCb(void* contents, size_t size, size_t nmemb, void* userp);
   static size_t writeCbIds(void* contents, size_t size, size_t nmemb, void* userp);
   static size_t writeCbCount(void* contents, size_t size, size_t nmemb, void* userp);
@@ -117,50 +371,165 @@ class GeomCache {
   // Get the right SPARQL query for the given backend.
   const std::string& getQuery(const std::string& backendUrl) const;
   const std::string& getCountQuery(const std::string& backendUrl) const;
+  const std::string& getHashQuery(const std::string& backendUrl) const;
 
-  std::string requestIndexHash();
+  std::string requestIndexHash(CURL* curl,
+                               const std::string& backendUrl) const;
+
+  // the name of the cache file for the given index hash
+  std::string cacheFileName(const std::string& indexHash) const;
 
   std::string queryUrl(std::string query, size_t offset, size_t limit) const;
 
-  util::geo::DLine parseLineString(const std::string& a, size_t p) const;
-  util::geo::FPoint parsePoint(const std::string& a, size_t p) const;
+  util::geo::DLine parseLineString(const char* p, const char* end) const;
+  util::geo::FPoint parsePoint(const char* p, const char* end) const;
+
+  void insertId(uint64_t val);
+
+  size_t joinRelObjects(const std::vector<IdMapping>& ids, size_t start,
+                        size_t end, std::pair<ID_TYPE, ID_TYPE>* out,
+                        size_t* numObjects) const;
 
   static bool pointValid(const util::geo::FPoint& p);
   static bool pointValid(const util::geo::DPoint& p);
 
-  void insertLine(const util::geo::DLine& l, bool isArea);
+  void insertLine(const util::geo::DLine& l, bool isArea, bool isHole,
+                  ParseBatch* batch) const;
 
-  std::string indexHashFromDisk(const std::string& fname);
+  void startPart(FillPart* part) const;
+  void finishPart(FillPart* part, CURLcode res);
 
-  std::vector<util::geo::FPoint> _points;
-  std::vector<util::geo::Point<int16_t>> _linePoints;
-  std::vector<size_t> _lines;
+  // true if all batches of the current stitch window have been stitched,
+  // requires _parseM
+  bool partStitched() const {
+    return _stitchPart < _partBatches.size() &&
+           _partBatches[_stitchPart] == _stitchSeq;
+  }
 
-  size_t _pointsFSize;
-  size_t _linePointsFSize;
-  size_t _linesFSize;
-  size_t _qidToIdFSize;
+  void startParseWorkers();
+  void stopParseWorkers();
+  void queueParseBatch(FillPart* part, bool last);
+  void parseInPlace(FillPart* part, const char* begin, const char* end);
+  void parseWorker();
+  void parseBatch(ParseBatch* batch) const;
+  void stitchParsed();
+  void stitchBatch(ParseBatch* batch);
+
+  static uint32_t geomHash(const void* data, size_t size);
+  static void wktFingerprint(const char* s, size_t size, uint64_t* hash,
+                             uint32_t* check);
+  size_t refreshFingerprint(uint64_t hash, uint32_t check) const;
+  static bool hexFingerprint(const char* s, size_t size, uint64_t* hash,
+                             uint32_t* check);
+  void refreshGeoms(size_t fp, IdMapping* lastQidToId,
+                    ParseBatch* batch) const;
+  bool hashQuerySupported();
+  void refreshPart(FillPart* part);
+  void fetchRows(FillPart* part, size_t start, size_t num);
+  void checkPart(FillPart* part, CURLcode res) const;
+  void addFingerprints(const ParseBatch& batch);
+  void freeRefresh();
+  size_t geomSlot(uint32_t hash, const void* data, size_t size) const;
+  void insertGeomSlot(size_t slot, uint32_t hash, ID_TYPE id);
+
+  // offsets into _linePoints, only valid while the lines are not compressed
+  size_t getLine(ID_TYPE id) const { return _lines[id]; }
+  size_t getLineEnd(ID_TYPE id) const {
+    return id + 1 < _lines.size() ? _lines[id + 1] : _linePoints.size();
+  }
 
-  std::fstream _pointsF;
-  std::fstream _linePointsF;
-  std::fstream _linesF;
-  std::fstream _qidToIdF;
+  void compressLines();
+  void decompressLines();
 
-  size_t _geometryDuplicates = 0;
+  void hilbertOrder();
+  static uint32_t hilbertKey(double x, double y);
 
-  IdMapping _lastQidToId;
+  void buildLods();
+  static void lodSignificance(const LineCoord* c, size_t n,
+                              std::vector<double>* sig);
 
-  std::vector<IdMapping> _qidToId;
+  std::string indexHashFromDisk(const std::string& fname);
+  bool hasFingerprints(const std::string& fname);
+  void fromLegacyDisk(const std::string& fname);
 
-  std::string _dangling, _prev, _raw;
+  template <typename T>
+  static void mapSection(int fd, const CacheSection& s, MappedArray<T>* arr);
+
+  MappedArray<util::geo::FPoint> _points;
+  MappedArray<util::geo::Point<int16_t>> _linePoints;
+  OffsetIndex _lines;
+
+  // compressed line points, if _linesCompressed, _lines holds the offsets
+  // of the lines into it, and _linePoints is empty
+  MappedArray<uint8_t> _lineBytes;
+  bool _linesCompressed = false;
+
+  // levels of detail, _lineLods holds for each line LOD_NONE or an index j
+  // into _lods, where level k of the line are the (plain) points
+  // [_lods[j * (LOD_LEVELS + 1) + k], _lods[j * (LOD_LEVELS + 1) + k + 1])
+  // of _lodPoints
+  MappedArray<uint32_t> _lineLods;
+  MappedArray<size_t> _lods;
+  MappedArray<util::geo::Point<int16_t>> _lodPoints;
+
+  size_t _geometryDuplicates = 0;
+
+  // dedup table of all geometries stored during the fill, each slot holds
+  // the upper 32 bits of the fingerprint and the geometry id
+  std::vector<uint64_t> _geomSlots;
+  size_t _numGeomSlots = 0;
+  size_t _dedupGeoms = 0;
+  size_t _dedupBytes = 0;
+
+  MappedArray<IdMapping> _qidToId;
+
+  // WKT fingerprints of all rows, sorted after the fill. Only built with a
+  // cache dir, they are freed once written and read from the cache file for
+  // a refresh.
+  MappedArray<GeomFingerprint> _fingerprints;
+  MappedArray<ID_TYPE> _fingerprintIds;
+
+  // geometries of the previous fill during an incremental refresh, rows
+  // with an unchanged WKT fingerprint are copied from here instead of
+  // being parsed again
+  MappedArray<util::geo::FPoint> _refreshPoints;
+  MappedArray<util::geo::Point<int16_t>> _refreshLinePoints;
+  OffsetIndex _refreshLines;
+  MappedArray<GeomFingerprint> _refreshFingerprints;
+  MappedArray<ID_TYPE> _refreshFingerprintIds;
+  size_t _refreshedGeoms = 0;
+
+  std::string _dangling, _raw;
   ParseState _state;
 
   std::exception_ptr _exceptionPtr;
 
+  // parse pipeline, the curl write callback parses the rows of its buffer in
+  // place, together with _parseThreads. Rows collected over several buffers
+  // are queued as raw batches. All batches are stitched in order of their
+  // window and seq, _inPlaceBatches are still referring to a curl buffer.
+  std::vector<std::thread> _parseThreads;
+  std::deque<ParseBatch> _parseQueue;
+  size_t _inPlaceBatches = 0;
+  std::map<std::pair<size_t, size_t>, ParseBatch> _parsed;
+  std::vector<size_t> _partBatches;
+  std::vector<size_t> _partRows;
+  size_t _stitchPart = 0;
+  size_t _stitchSeq = 0;
+  bool _parseDone = false;
+  std::exception_ptr _parseExceptionPtr;
+  std::mutex _parseM;
+  std::mutex _stitchM;
+  std::condition_variable _parseCv;
+  std::condition_variable _parsedCv;
+
   mutable std::mutex _m;
   bool _ready = false;
 
   std::string _indexHash;
+
+  // the cache file last read or written
+  std::string _cacheFile;
 };
 }  // namespace petrimaps
 
@@ -5,9 +5,13 @@
 #ifndef PETRIMAPS_GRID_H_
 #define PETRIMAPS_GRID_H_
 
+#include <algorithm>
+#include <exception>
 #include <map>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include "qlever-petrimaps/Misc.h"
 #include "util/geo/Geo.h"
 
 namespace petrimaps {
@@ -17,6 +21,24 @@ class GridException : public std::runtime_error {
   GridException(std::string const& msg) : std::runtime_error(msg) {}
 };
 
+// a read-only view of the contents of a grid cell
+template <typename V>
+class GridCell {
+ public:
+  GridCell() : _begin(0), _end(0) {}
+  GridCell(const V* begin, const V* end) : _begin(begin), _end(end) {}
+
+  const V* begin() const { return _begin; }
+  const V* end() const { return _end; }
+  size_t size() const { return _end - _begin; }
+  bool empty() const { return _begin == _end; }
+  const V& operator[](size_t i) const { return _begin[i]; }
+
+ private:
+  const V* _begin;
+  const V* _end;
+};
+
 template <typename V, typename T>
 class Grid {
  public:
@@ -29,11 +51,23 @@ class Grid {
         _bb(o._bb),
         _xWidth(o._xWidth),
         _yHeight(o._yHeight),
-        _grid(o._grid) {
+        _grid(o._grid),
+        _sparse(o._sparse),
+        _sparseCells(std::move(o._sparseCells)),
+        _frozen(o._frozen),
+        _offsets(std::move(o._offsets)),
+        _values(std::move(o._values)),
+        _split(std::move(o._split)),
+        _subOffsets(std::move(o._subOffsets)),
+        _memory(o._memory),
+        _charged(o._charged) {
     o._grid = 0;
+    o._frozen = false;
+    o._charged = 0;
   }
 
   Grid<V, T>& operator=(Grid<V, T>&& o) {
+    clear();
     _width = o._width;
     _height = o._height;
     _cellWidth = o._cellWidth;
@@ -42,7 +76,18 @@ class Grid {
     _xWidth = o._xWidth;
     _yHeight = o._yHeight;
     _grid = o._grid;
+    _sparse = o._sparse;
+    _sparseCells = std::move(o._sparseCells);
+    _frozen = o._frozen;
+    _offsets = std::move(o._offsets);
+    _values = std::move(o._values);
+    _split = std::move(o._split);
+    _subOffsets = std::move(o._subOffsets);
+    _memory = o._memory;
+    _charged = o._charged;
     o._grid = 0;
+    o._frozen = false;
+    o._charged = 0;
 
     return *this;
   };
@@ -51,28 +96,56 @@ class Grid {
   // that covers the area of bounding box bbox
   Grid(double w, double h, const util::geo::Box<T>& bbox);
 
+  // as above, the cells are charged to memory before they are allocated. A
+  // sparse grid has no cell table, it keeps its non-empty cells in a hash
+  // map and can only be frozen, e.g. as a partial grid.
+  Grid(double w, double h, const util::geo::Box<T>& bbox,
+       MemoryBudget* memory, bool sparse = false);
+
   // the empty grid
   Grid();
 
-  ~Grid() {
-    if (!_grid) return;
-    for (size_t i = 0; i < _xWidth * _yHeight; i++) {
-      if (!_grid[i]) continue;
-      delete _grid[i];
-    }
-    delete[] _grid;
-  }
+  ~Grid() { clear(); }
 
-  // add object t to this grid
+  // add object t to this grid, not possible once the grid is frozen
   void add(const util::geo::Box<T>& box, const V& val);
   void add(const util::geo::Point<T>& box, const V& val);
   void add(size_t x, size_t y, V val);
 
+  // move the cell contents into one flat array of values, with the cells
+  // given by offsets into it
+  void freeze(size_t numThreads);
+
+  // as above, but with the contents of the partial grids parts, which must
+  // cover the same area as this grid. The contents of each cell are
+  // concatenated in the order of parts.
+  void freeze(const std::vector<Grid<V, T>>& parts, size_t numThreads);
+
+  bool frozen() const { return _frozen; }
+
+  // split each cell of a frozen grid holding more than maxCell values into
+  // levels of sub-cells, so that box queries only return the sub-cells they
+  // need. box(val, cellBox) gives the bounding box of a value in the cell
+  // with bounding box cellBox. The contents of a split cell are reordered.
+  template <typename F>
+  void split(size_t maxCell, F box, size_t numThreads);
+
   void get(const util::geo::Box<T>& btbox, std::unordered_set<V>* s) const;
   void get(size_t x, size_t y, std::unordered_set<V>* s) const;
   void get(const util::geo::Box<T>& btbox, std::vector<V>* s) const;
   void get(size_t x, size_t y, std::vector<V>* s) const;
-  const std::vector<V>* getCell(size_t x, size_t y) const;
+  GridCell<V> getCell(size_t x, size_t y) const;
+
+  // call f(box, begin, end) for the values of the cells intersecting btbox,
+  // a split cell is given by its non-empty sub-cells intersecting btbox.
+  // box is the bounding box of the (sub-)cell. Values are stored at the
+  // (sub-)cell of their lower left corner, so unlike points, other values
+  // may extend beyond box.
+  template <typename F>
+  void getCells(const util::geo::Box<T>& btbox, F f) const;
+  template <typename F>
+  void getCells(size_t x, size_t y, const util::geo::Box<T>& btbox,
+                F f) const;
 
   size_t getXWidth() const;
   size_t getYHeight() const;
@@ -98,7 +171,45 @@ class Grid {
   size_t _xWidth;
   size_t _yHeight;
 
+  // cells while the grid is built, in a table or, if the grid is sparse, in
+  // a map from the cell index
   std::vector<V>** _grid;
+  bool _sparse;
+  std::unordered_map<size_t, std::vector<V>> _sparseCells;
+
+  // cells after the grid was frozen, cell i holds the values from
+  // _offsets[i] to _offsets[i + 1]
+  bool _frozen;
+  std::vector<size_t> _offsets;
+  std::vector<V> _values;
+
+  struct SplitCell {
+    // number of sub-cells per dimension on the finest level, a power of 2
+    size_t sub;
+    // position of the offsets of the sub-cells in _subOffsets, level by
+    // level from the finest to the coarsest, each in row order
+    size_t offsets;
+  };
+
+  std::unordered_map<size_t, SplitCell> _split;
+  std::vector<size_t> _subOffsets;
+
+  MemoryBudget* _memory;
+  size_t _charged;
+
+  void clear();
+  void freeze(const std::vector<std::vector<V>**>& tables,
+              size_t numThreads);
+  void freeze(const std::vector<const Grid<V, T>*>& parts,
+              size_t numThreads);
+
+  // call f(begin, end) for ranges of values which contain all values of
+  // the cells intersecting box
+  template <typename F>
+  void getRanges(const util::geo::Box<T>& box, F f) const;
+
+  size_t getSubCell(double v, double cellStart, double subSize,
+                    size_t sub) const;
 };
 
 #include "qlever-petrimaps/Grid.tpp"
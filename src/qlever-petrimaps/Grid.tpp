@@ -11,12 +11,29 @@ Grid<V, T>::Grid()
       _cellHeight(0),
       _xWidth(0),
       _yHeight(0),
-      _grid(0) {}
+      _grid(0),
+      _sparse(false),
+      _frozen(false),
+      _memory(0),
+      _charged(0) {}
 
 // _____________________________________________________________________________
 template <typename V, typename T>
 Grid<V, T>::Grid(double w, double h, const util::geo::Box<T>& bbox)
-    : _cellWidth(fabs(w)), _cellHeight(fabs(h)), _bb(bbox), _grid() {
+    : Grid(w, h, bbox, 0, false) {}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+Grid<V, T>::Grid(double w, double h, const util::geo::Box<T>& bbox,
+                 MemoryBudget* memory, bool sparse)
+    : _cellWidth(fabs(w)),
+      _cellHeight(fabs(h)),
+      _bb(bbox),
+      _grid(),
+      _sparse(sparse),
+      _frozen(false),
+      _memory(memory),
+      _charged(0) {
   _width = bbox.getUpperRight().getX() - bbox.getLowerLeft().getX();
   _height = bbox.getUpperRight().getY() - bbox.getLowerLeft().getY();
 
@@ -31,7 +48,11 @@ Grid<V, T>::Grid(double w, double h, const util::geo::Box<T>& bbox)
   _xWidth = ceil(_width / _cellWidth);
   _yHeight = ceil(_height / _cellHeight);
 
+  if (_sparse) return;
+
   // resize rows
+  if (_memory) _memory->charge(_xWidth * _yHeight * sizeof(std::vector<V>*));
+  _charged = _xWidth * _yHeight * sizeof(std::vector<V>*);
   _grid = new std::vector<V>*[_xWidth * _yHeight];
   memset(_grid, 0, _xWidth * _yHeight * sizeof(std::vector<V>*));
 }
@@ -62,56 +83,468 @@ void Grid<V, T>::add(const util::geo::Box<T>& box, const V& val) {
 template <typename V, typename T>
 void Grid<V, T>::add(size_t x, size_t y, V val) {
   if (x >= _xWidth || y >= _yHeight) return;
-  if (!_grid[y * _xWidth + x]) _grid[y * _xWidth + x] = new std::vector<V>();
-  _grid[y * _xWidth + x]->push_back(val);
+  if (_frozen) throw GridException("Cannot add to a frozen grid");
+
+  std::vector<V>* cell;
+  if (_sparse) {
+    auto it = _sparseCells.find(y * _xWidth + x);
+    if (it == _sparseCells.end()) {
+      // the map node and its bucket
+      size_t bytes = sizeof(*it) + 2 * sizeof(void*);
+      if (_memory) _memory->charge(bytes);
+      _charged += bytes;
+      it = _sparseCells.emplace(y * _xWidth + x, std::vector<V>()).first;
+    }
+    cell = &it->second;
+  } else {
+    auto& c = _grid[y * _xWidth + x];
+    if (!c) {
+      if (_memory) _memory->charge(sizeof(std::vector<V>));
+      _charged += sizeof(std::vector<V>);
+      c = new std::vector<V>();
+    }
+    cell = c;
+  }
+
+  _charged += reserveCharged(cell, cell->size() + 1, _memory);
+  cell->push_back(val);
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+void Grid<V, T>::freeze(size_t numThreads) {
+  if (_sparse) {
+    freeze(std::vector<const Grid<V, T>*>{this}, numThreads);
+  } else {
+    freeze(std::vector<std::vector<V>**>{_grid}, numThreads);
+  }
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+void Grid<V, T>::freeze(const std::vector<Grid<V, T>>& parts,
+                        size_t numThreads) {
+  std::vector<const Grid<V, T>*> ptrs;
+  for (const auto& part : parts) ptrs.push_back(&part);
+  freeze(ptrs, numThreads);
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+void Grid<V, T>::freeze(const std::vector<const Grid<V, T>*>& parts,
+                        size_t numThreads) {
+  if (_frozen) throw GridException("Grid is already frozen");
+
+  size_t cells = _xWidth * _yHeight;
+
+  // the non-empty cells of the parts, in order of the parts
+  size_t num = 0;
+  for (auto part : parts) {
+    if (part->_sparse) {
+      num += part->_sparseCells.size();
+    } else if (part->_grid) {
+      for (size_t i = 0; i < cells; i++) num += part->_grid[i] != 0;
+    }
+  }
+
+  std::vector<std::pair<size_t, const std::vector<V>*>> partCells;
+  size_t tmpBytes = reserveCharged(&partCells, num, _memory);
+
+  for (auto part : parts) {
+    if (part->_sparse) {
+      for (const auto& c : part->_sparseCells) {
+        partCells.push_back({c.first, &c.second});
+      }
+    } else if (part->_grid) {
+      for (size_t i = 0; i < cells; i++) {
+        if (part->_grid[i]) partCells.push_back({i, part->_grid[i]});
+      }
+    }
+  }
+
+  size_t bytes = 0;
+
+  std::vector<size_t> offsets;
+  std::vector<V> values;
+
+  try {
+    if (_memory) _memory->charge((cells + 1) * sizeof(size_t));
+    bytes += (cells + 1) * sizeof(size_t);
+    offsets.resize(cells + 1, 0);
+
+    for (const auto& c : partCells) offsets[c.first + 1] += c.second->size();
+    for (size_t i = 0; i < cells; i++) offsets[i + 1] += offsets[i];
+
+    if (_memory) _memory->charge(offsets.back() * sizeof(V));
+    bytes += offsets.back() * sizeof(V);
+    values.resize(offsets.back());
+  } catch (...) {
+    if (_memory) _memory->release(bytes + tmpBytes);
+    throw;
+  }
+
+  // the position of the values of each part cell, the values of a cell are
+  // concatenated in order of the parts. Afterwards, offsets[i] is the end of
+  // cell i, and the offsets are moved back by one.
+  for (auto& c : partCells) {
+    size_t cell = c.first;
+    c.first = offsets[cell];
+    offsets[cell] += c.second->size();
+  }
+  for (size_t i = cells; i > 0; i--) offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 256)
+  for (size_t j = 0; j < partCells.size(); j++) {
+    const auto& c = partCells[j];
+    std::copy(c.second->begin(), c.second->end(), values.begin() + c.first);
+  }
+
+  std::vector<std::pair<size_t, const std::vector<V>*>>().swap(partCells);
+  if (_memory) _memory->release(tmpBytes);
+
+  // the cells of this grid are no longer needed
+  clear();
+
+  _offsets.swap(offsets);
+  _values.swap(values);
+  _charged = bytes;
+  _frozen = true;
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+void Grid<V, T>::freeze(const std::vector<std::vector<V>**>& tables,
+                        size_t numThreads) {
+  if (_frozen) throw GridException("Grid is already frozen");
+
+  size_t cells = _xWidth * _yHeight;
+  size_t bytes = (cells + 1) * sizeof(size_t);
+  if (_memory) _memory->charge(bytes);
+
+  std::vector<size_t> offsets;
+  std::vector<V> values;
+
+  try {
+    offsets.resize(cells + 1, 0);
+
+    // first pass, count the values of each cell
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (size_t i = 0; i < cells; i++) {
+      for (auto table : tables) {
+        if (table && table[i]) offsets[i + 1] += table[i]->size();
+      }
+    }
+
+    for (size_t i = 0; i < cells; i++) offsets[i + 1] += offsets[i];
+
+    if (_memory) _memory->charge(offsets.back() * sizeof(V));
+    bytes += offsets.back() * sizeof(V);
+    values.resize(offsets.back());
+  } catch (...) {
+    if (_memory) _memory->release(bytes);
+    throw;
+  }
+
+  // second pass, copy the values into their cells
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 256)
+  for (size_t i = 0; i < cells; i++) {
+    size_t off = offsets[i];
+    for (auto table : tables) {
+      if (!table || !table[i]) continue;
+      std::copy(table[i]->begin(), table[i]->end(), values.begin() + off);
+      off += table[i]->size();
+    }
+  }
+
+  // the cells of this grid are no longer needed
+  clear();
+
+  _offsets.swap(offsets);
+  _values.swap(values);
+  _charged = bytes;
+  _frozen = true;
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+void Grid<V, T>::clear() {
+  if (_memory) _memory->release(_charged);
+  _charged = 0;
+  _frozen = false;
+  std::vector<size_t>().swap(_offsets);
+  std::vector<V>().swap(_values);
+  _split.clear();
+  std::vector<size_t>().swap(_subOffsets);
+  std::unordered_map<size_t, std::vector<V>>().swap(_sparseCells);
+  if (!_grid) return;
+  for (size_t i = 0; i < _xWidth * _yHeight; i++) {
+    if (!_grid[i]) continue;
+    delete _grid[i];
+  }
+  delete[] _grid;
+  _grid = 0;
 }
 
 // _____________________________________________________________________________
 template <typename V, typename T>
 void Grid<V, T>::get(const util::geo::Box<T>& box,
                      std::vector<V>* s) const {
+  getRanges(box, [s](const V* begin, const V* end) {
+    s->insert(s->end(), begin, end);
+  });
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+void Grid<V, T>::get(const util::geo::Box<T>& box,
+                     std::unordered_set<V>* s) const {
+  getRanges(box,
+            [s](const V* begin, const V* end) { s->insert(begin, end); });
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+template <typename F>
+void Grid<V, T>::getRanges(const util::geo::Box<T>& box, F f) const {
   size_t swX = getCellXFromX(box.getLowerLeft().getX());
   size_t swY = getCellYFromY(box.getLowerLeft().getY());
 
   size_t neX = getCellXFromX(box.getUpperRight().getX());
   size_t neY = getCellYFromY(box.getUpperRight().getY());
 
-  for (size_t x = swX; x <= neX && x < _xWidth; x++)
-    for (size_t y = swY; y <= neY && y < _yHeight; y++) get(x, y, s);
+  for (size_t x = swX; x <= neX && x < _xWidth; x++) {
+    for (size_t y = swY; y <= neY && y < _yHeight; y++) {
+      auto split = _split.empty() ? _split.end() : _split.find(y * _xWidth + x);
+
+      if (split == _split.end()) {
+        auto cell = getCell(x, y);
+        if (!cell.empty()) f(cell.begin(), cell.end());
+        continue;
+      }
+
+      const auto& cellBox = getBox(x, y);
+      const size_t* offs = _subOffsets.data() + split->second.offsets;
+
+      // a value is stored at the sub-cell of its lower left corner, and
+      // extends at most into the next sub-cell
+      for (size_t sub = split->second.sub; sub > 0; sub /= 2) {
+        double subW = _cellWidth / sub;
+        double subH = _cellHeight / sub;
+
+        size_t sx0 = getSubCell(box.getLowerLeft().getX(),
+                                cellBox.getLowerLeft().getX(), subW, sub);
+        size_t sx1 = getSubCell(box.getUpperRight().getX(),
+                                cellBox.getLowerLeft().getX(), subW, sub);
+        size_t sy0 = getSubCell(box.getLowerLeft().getY(),
+                                cellBox.getLowerLeft().getY(), subH, sub);
+        size_t sy1 = getSubCell(box.getUpperRight().getY(),
+                                cellBox.getLowerLeft().getY(), subH, sub);
+        if (sx0 > 0) sx0--;
+        if (sy0 > 0) sy0--;
+
+        // the sub-cells of a row are stored consecutively
+        for (size_t sy = sy0; sy <= sy1; sy++) {
+          size_t begin = offs[sy * sub + sx0];
+          size_t end = offs[sy * sub + sx1 + 1];
+          if (end > begin) f(_values.data() + begin, _values.data() + end);
+        }
+
+        offs += sub * sub;
+      }
+    }
+  }
 }
 
 // _____________________________________________________________________________
 template <typename V, typename T>
-void Grid<V, T>::get(const util::geo::Box<T>& box,
-                     std::unordered_set<V>* s) const {
+template <typename F>
+void Grid<V, T>::getCells(const util::geo::Box<T>& box, F f) const {
   size_t swX = getCellXFromX(box.getLowerLeft().getX());
   size_t swY = getCellYFromY(box.getLowerLeft().getY());
 
   size_t neX = getCellXFromX(box.getUpperRight().getX());
   size_t neY = getCellYFromY(box.getUpperRight().getY());
 
-  for (size_t x = swX; x <= neX && x < _xWidth; x++)
-    for (size_t y = swY; y <= neY && y < _yHeight; y++) get(x, y, s);
+  for (size_t x = swX; x <= neX && x < _xWidth; x++) {
+    for (size_t y = swY; y <= neY && y < _yHeight; y++) {
+      getCells(x, y, box, f);
+    }
+  }
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+template <typename F>
+void Grid<V, T>::getCells(size_t x, size_t y, const util::geo::Box<T>& box,
+                          F f) const {
+  const auto& cellBox = getBox(x, y);
+  auto split = _split.empty() ? _split.end() : _split.find(y * _xWidth + x);
+
+  if (split == _split.end()) {
+    auto cell = getCell(x, y);
+    if (!cell.empty()) f(cellBox, cell.begin(), cell.end());
+    return;
+  }
+
+  const size_t* offs = _subOffsets.data() + split->second.offsets;
+  const auto& ll = cellBox.getLowerLeft();
+
+  for (size_t sub = split->second.sub; sub > 0; sub /= 2) {
+    double subW = _cellWidth / sub;
+    double subH = _cellHeight / sub;
+
+    size_t sx0 = getSubCell(box.getLowerLeft().getX(), ll.getX(), subW, sub);
+    size_t sx1 = getSubCell(box.getUpperRight().getX(), ll.getX(), subW, sub);
+    size_t sy0 = getSubCell(box.getLowerLeft().getY(), ll.getY(), subH, sub);
+    size_t sy1 = getSubCell(box.getUpperRight().getY(), ll.getY(), subH, sub);
+    if (sx0 > 0) sx0--;
+    if (sy0 > 0) sy0--;
+
+    for (size_t sy = sy0; sy <= sy1; sy++) {
+      for (size_t sx = sx0; sx <= sx1; sx++) {
+        size_t begin = offs[sy * sub + sx];
+        size_t end = offs[sy * sub + sx + 1];
+        if (end == begin) continue;
+
+        util::geo::Point<T> sw(ll.getX() + sx * subW, ll.getY() + sy * subH);
+        util::geo::Point<T> ne(ll.getX() + (sx + 1) * subW,
+                               ll.getY() + (sy + 1) * subH);
+        f(util::geo::Box<T>(sw, ne), _values.data() + begin,
+          _values.data() + end);
+      }
+    }
+
+    offs += sub * sub;
+  }
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+size_t Grid<V, T>::getSubCell(double v, double cellStart, double subSize,
+                              size_t sub) const {
+  double dist = v - cellStart;
+  if (dist < 0) return 0;
+  return std::min(sub - 1, static_cast<size_t>(dist / subSize));
+}
+
+// _____________________________________________________________________________
+template <typename V, typename T>
+template <typename F>
+void Grid<V, T>::split(size_t maxCell, F box, size_t numThreads) {
+  if (!_frozen) throw GridException("Only frozen grids can be split");
+
+  // collect the cells to split, with on average at most a quarter of
+  // maxCell values per sub-cell
+  std::vector<std::pair<size_t, SplitCell>> cells;
+  size_t numOffsets = _subOffsets.size();
+  for (size_t i = 0; i < _xWidth * _yHeight; i++) {
+    size_t n = _offsets[i + 1] - _offsets[i];
+    if (n <= maxCell || _split.count(i)) continue;
+    size_t sub = 2;
+    while (sub < 256 && sub * sub * maxCell < 4 * n) sub *= 2;
+    cells.push_back({i, {sub, numOffsets}});
+    for (; sub > 0; sub /= 2) numOffsets += sub * sub;
+    numOffsets++;
+  }
+
+  if (cells.empty()) return;
+
+  // the sub-cell offsets and the nodes and buckets of _split
+  size_t bytes = (numOffsets - _subOffsets.size()) * sizeof(size_t) +
+                 cells.size() * (sizeof(typename decltype(_split)::value_type) +
+                                 2 * sizeof(void*));
+  if (_memory) _memory->charge(bytes);
+  _charged += bytes;
+  _subOffsets.resize(numOffsets, 0);
+
+  std::exception_ptr ePtr;
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic, 1)
+  for (size_t j = 0; j < cells.size(); j++) {
+    try {
+      size_t i = cells[j].first;
+      size_t* offs = _subOffsets.data() + cells[j].second.offsets;
+      const auto& cellBox = getBox(i % _xWidth, i / _xWidth);
+      const auto& ll = cellBox.getLowerLeft();
+      const auto& ur = cellBox.getUpperRight();
+
+      size_t begin = _offsets[i];
+      size_t n = _offsets[i + 1] - begin;
+
+      // the sub-cells of all levels, from sub x sub sub-cells down to a
+      // single one, are numbered consecutively. Each value is put into the
+      // finest level whose sub-cells are at least as large as the part of
+      // the value within the cell, at the sub-cell of its lower left corner.
+      std::vector<uint32_t> buckets(n);
+      for (size_t k = 0; k < n; k++) {
+        const auto& b = box(_values[begin + k], cellBox);
+        double x0 = std::max<double>(b.getLowerLeft().getX(), ll.getX());
+        double y0 = std::max<double>(b.getLowerLeft().getY(), ll.getY());
+        double w = std::min<double>(b.getUpperRight().getX(), ur.getX()) - x0;
+        double h = std::min<double>(b.getUpperRight().getY(), ur.getY()) - y0;
+
+        size_t bucket = 0;
+        size_t sub = cells[j].second.sub;
+        while (sub > 1 && (w > _cellWidth / sub || h > _cellHeight / sub)) {
+          bucket += sub * sub;
+          sub /= 2;
+        }
+
+        bucket += getSubCell(y0, ll.getY(), _cellHeight / sub, sub) * sub +
+                  getSubCell(x0, ll.getX(), _cellWidth / sub, sub);
+        buckets[k] = bucket;
+        offs[bucket + 1]++;
+      }
+
+      offs[0] = begin;
+      size_t numBuckets = 0;
+      for (size_t sub = cells[j].second.sub; sub > 0; sub /= 2) {
+        numBuckets += sub * sub;
+      }
+      for (size_t k = 1; k <= numBuckets; k++) offs[k] += offs[k - 1];
+
+      // stable counting sort of the values by bucket
+      std::vector<size_t> pos(offs, offs + numBuckets);
+      std::vector<V> sorted(n);
+      for (size_t k = 0; k < n; k++) {
+        sorted[pos[buckets[k]]++ - begin] = _values[begin + k];
+      }
+      std::copy(sorted.begin(), sorted.end(), _values.begin() + begin);
+    } catch (...) {
+#pragma omp critical
+      { ePtr = std::current_exception(); }
+    }
+  }
+
+  if (ePtr) std::rethrow_exception(ePtr);
+
+  _split.insert(cells.begin(), cells.end());
 }
 
 // _____________________________________________________________________________
 template <typename V, typename T>
 void Grid<V, T>::get(size_t x, size_t y, std::unordered_set<V>* s) const {
-  if (!_grid[y * _xWidth + x]) return;
-  s->insert(_grid[y * _xWidth + x]->begin(), _grid[y * _xWidth + x]->end());
+  auto cell = getCell(x, y);
+  s->insert(cell.begin(), cell.end());
 }
 
 // _____________________________________________________________________________
 template <typename V, typename T>
 void Grid<V, T>::get(size_t x, size_t y, std::vector<V>* s) const {
-  if (!_grid[y * _xWidth + x]) return;
-  s->insert(s->end(), _grid[y * _xWidth + x]->begin(), _grid[y * _xWidth + x]->end());
+  auto cell = getCell(x, y);
+  s->insert(s->end(), cell.begin(), cell.end());
 }
 
 // _____________________________________________________________________________
 template <typename V, typename T>
-const std::vector<V>* Grid<V, T>::getCell(size_t x, size_t y) const {
-  return _grid[y * _xWidth + x];
+GridCell<V> Grid<V, T>::getCell(size_t x, size_t y) const {
+  size_t i = y * _xWidth + x;
+  if (_frozen) {
+    return {_values.data() + _offsets[i], _values.data() + _offsets[i + 1]};
+  }
+  if (!_grid[i]) return {};
+  return {_grid[i]->data(), _grid[i]->data() + _grid[i]->size()};
 }
 
 // _____________________________________________________________________________
@@ -0,0 +1,393 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#ifndef PETRIMAPS_LINECODEC_H_
+#define PETRIMAPS_LINECODEC_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "qlever-petrimaps/Misc.h"
+#include "util/geo/Geo.h"
+
+namespace petrimaps {
+
+// A line in the cache is a sequence of int16 points: major coordinates
+// (isMCoord), which select the cell of the points following them, the lower
+// left and upper right corner of the bounding box, the vertices, and a
+// trailing major coordinate marking areas and holes (see
+// GeomCache::insertLine()). The absolute coordinate of a point, in
+// decimeters, is major * M_COORD_GRANULARITY + minor.
+//
+// In compressed form, a line is stored as
+//   varint   number of vertices << 2 | flags
+//   varint   zigzag x and y of the lower left corner
+//   varint   zigzag x and y difference of the upper right corner to it
+// followed by blocks of up to LINE_BLOCK vertices. Each block starts with
+// the bit widths of its x and y differences (1 byte each), followed by the
+// bit-packed zigzag differences of each vertex to its predecessor (to the
+// lower left corner for the first one). Arrays of compressed lines are
+// followed by LINE_PADDING bytes, so that 8 bytes can always be read at
+// once.
+
+static const uint8_t LINE_AREA = 1;
+static const uint8_t LINE_HOLE = 2;
+
+static const size_t LINE_BLOCK = 64;
+static const size_t LINE_PADDING = 8;
+
+typedef util::geo::Point<int32_t> LineCoord;
+
+// _____________________________________________________________________________
+inline uint8_t lineFlags(const util::geo::Point<int16_t>* end) {
+  // flags of the plain line ending at end, holes are areas, too
+  const auto& last = *(end - 1);
+  if (!isMCoord(last.getX())) return 0;
+  return rmCoord(last.getY()) == 1 ? LINE_AREA | LINE_HOLE : LINE_AREA;
+}
+
+// _____________________________________________________________________________
+inline uint32_t lineZigzag(int32_t v) {
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+// _____________________________________________________________________________
+inline int32_t lineUnzigzag(uint32_t v) {
+  return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+// _____________________________________________________________________________
+inline void lineWriteVarint(uint32_t v, std::vector<uint8_t>* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(v));
+}
+
+// _____________________________________________________________________________
+inline const uint8_t* lineReadVarint(const uint8_t* p, uint32_t* v) {
+  *v = *p & 0x7F;
+  size_t shift = 7;
+  while (*p++ & 0x80) {
+    *v |= static_cast<uint32_t>(*p & 0x7F) << shift;
+    shift += 7;
+  }
+  return p;
+}
+
+// _____________________________________________________________________________
+inline uint32_t lineReadBits(const uint8_t* p, size_t bit, uint8_t width) {
+  // Reads width (<= 32) bits at bit offset bit of p.
+  p += bit >> 3;
+  uint64_t v;
+  if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+    memcpy(&v, p, 8);
+  } else {
+    v = 0;
+    for (size_t i = 0; i < 8; i++) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+  }
+  return (v >> (bit & 7)) & ((1ULL << width) - 1);
+}
+
+// _____________________________________________________________________________
+inline uint8_t lineBitWidth(uint32_t v) {
+  return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// _____________________________________________________________________________
+inline void lineCoords(const util::geo::Point<int16_t>* p,
+                       const util::geo::Point<int16_t>* end,
+                       std::vector<LineCoord>* out) {
+  // Writes the absolute coordinates of the bounding box corners and the
+  // vertices of the plain line [p, end) to out.
+  int32_t mainX = 0;
+  int32_t mainY = 0;
+  for (; p < end; p++) {
+    if (isMCoord(p->getX())) {
+      mainX = rmCoord(p->getX());
+      mainY = rmCoord(p->getY());
+      continue;
+    }
+    out->push_back(LineCoord(mainX * M_COORD_GRANULARITY + p->getX(),
+                             mainY * M_COORD_GRANULARITY + p->getY()));
+  }
+}
+
+// _____________________________________________________________________________
+inline void linePoints(const LineCoord* c, const LineCoord* end,
+                       uint8_t flags,
+                       std::vector<util::geo::Point<int16_t>>* out) {
+  // Writes the plain line of the absolute coordinates [c, end) to out,
+  // exactly as GeomCache::insertLine() does.
+  int16_t mainX = 0;
+  int16_t mainY = 0;
+  for (; c < end; c++) {
+    int16_t mainXLoc = c->getX() / M_COORD_GRANULARITY;
+    int16_t mainYLoc = c->getY() / M_COORD_GRANULARITY;
+    if (mainXLoc != mainX || mainYLoc != mainY) {
+      mainX = mainXLoc;
+      mainY = mainYLoc;
+      out->push_back(util::geo::Point<int16_t>(mCoord(mainX), mCoord(mainY)));
+    }
+    out->push_back(util::geo::Point<int16_t>(
+        c->getX() - mainX * M_COORD_GRANULARITY,
+        c->getY() - mainY * M_COORD_GRANULARITY));
+  }
+
+  if (flags & LINE_AREA) {
+    out->push_back(util::geo::Point<int16_t>(
+        mCoord(0), mCoord(flags & LINE_HOLE ? 1 : 0)));
+  }
+}
+
+// _____________________________________________________________________________
+inline void lineEncode(const LineCoord* c, const LineCoord* end,
+                       uint8_t flags, std::vector<uint8_t>* out) {
+  // Appends the compressed form of the line with the bounding box corners
+  // and vertices [c, end) to out.
+  size_t n = end - c - 2;
+  lineWriteVarint((static_cast<uint32_t>(n) << 2) | flags, out);
+  lineWriteVarint(lineZigzag(c[0].getX()), out);
+  lineWriteVarint(lineZigzag(c[0].getY()), out);
+  lineWriteVarint(lineZigzag(c[1].getX() - c[0].getX()), out);
+  lineWriteVarint(lineZigzag(c[1].getY() - c[0].getY()), out);
+
+  uint32_t zx[LINE_BLOCK];
+  uint32_t zy[LINE_BLOCK];
+
+  LineCoord prev = c[0];
+  for (const LineCoord* b = c + 2; b < end; b += LINE_BLOCK) {
+    size_t bn = std::min<size_t>(LINE_BLOCK, end - b);
+
+    uint32_t orX = 0;
+    uint32_t orY = 0;
+    for (size_t i = 0; i < bn; i++) {
+      zx[i] = lineZigzag(b[i].getX() - prev.getX());
+      zy[i] = lineZigzag(b[i].getY() - prev.getY());
+      orX |= zx[i];
+      orY |= zy[i];
+      prev = b[i];
+    }
+
+    uint8_t wx = lineBitWidth(orX);
+    uint8_t wy = lineBitWidth(orY);
+    out->push_back(wx);
+    out->push_back(wy);
+
+    uint64_t acc = 0;
+    size_t bits = 0;
+    for (size_t i = 0; i < bn; i++) {
+      acc |= static_cast<uint64_t>(zx[i]) << bits;
+      bits += wx;
+      for (; bits >= 8; bits -= 8, acc >>= 8) out->push_back(acc & 0xFF);
+      acc |= static_cast<uint64_t>(zy[i]) << bits;
+      bits += wy;
+      for (; bits >= 8; bits -= 8, acc >>= 8) out->push_back(acc & 0xFF);
+    }
+    if (bits) out->push_back(acc & 0xFF);
+  }
+}
+
+// _____________________________________________________________________________
+inline const uint8_t* lineDecodeHeader(const uint8_t* p, size_t* n,
+                                       uint8_t* flags, LineCoord* ll,
+                                       LineCoord* ur) {
+  // Reads the number of vertices, the flags and the bounding box corners of
+  // the compressed line at p, and returns the position of its first block.
+  uint32_t v, x, y;
+  p = lineReadVarint(p, &v);
+  *n = v >> 2;
+  *flags = v & 3;
+
+  p = lineReadVarint(p, &x);
+  p = lineReadVarint(p, &y);
+  *ll = LineCoord(lineUnzigzag(x), lineUnzigzag(y));
+  p = lineReadVarint(p, &x);
+  p = lineReadVarint(p, &y);
+  *ur = LineCoord(ll->getX() + lineUnzigzag(x), ll->getY() + lineUnzigzag(y));
+  return p;
+}
+
+// _____________________________________________________________________________
+inline const uint8_t* lineDecode(const uint8_t* p, size_t n, LineCoord* prev,
+                                 LineCoord* out) {
+  // Decodes the next block of n vertices of a compressed line at p into
+  // out, prev holds the previous vertex. Returns the position after the
+  // block. The block has fixed bit widths, so the loop below is free of
+  // branches.
+  uint8_t wx = p[0];
+  uint8_t wy = p[1];
+  p += 2;
+
+  int32_t x = prev->getX();
+  int32_t y = prev->getY();
+  size_t bit = 0;
+  for (size_t i = 0; i < n; i++) {
+    x += lineUnzigzag(lineReadBits(p, bit, wx));
+    bit += wx;
+    y += lineUnzigzag(lineReadBits(p, bit, wy));
+    bit += wy;
+    out[i] = LineCoord(x, y);
+  }
+
+  *prev = LineCoord(x, y);
+  return p + (bit + 7) / 8;
+}
+
+// _____________________________________________________________________________
+inline uint8_t lineDecodeAll(const uint8_t* p, std::vector<LineCoord>* out) {
+  // Writes the bounding box corners and the vertices of the compressed line
+  // at p to out, and returns its flags.
+  size_t n;
+  uint8_t flags;
+  LineCoord ll, ur;
+  p = lineDecodeHeader(p, &n, &flags, &ll, &ur);
+
+  size_t off = out->size();
+  out->resize(off + 2 + n);
+  (*out)[off] = ll;
+  (*out)[off + 1] = ur;
+
+  LineCoord prev = ll;
+  for (size_t i = 0; i < n; i += LINE_BLOCK) {
+    p = lineDecode(p, std::min(LINE_BLOCK, n - i), &prev,
+                   out->data() + off + 2 + i);
+  }
+  return flags;
+}
+
+// Reads the bounding box and the vertices of a line, either from the plain
+// int16 points or from the compressed form.
+class LineReader {
+ public:
+  // read the plain line [p, end)
+  LineReader(const util::geo::Point<int16_t>* p,
+             const util::geo::Point<int16_t>* end)
+      : _cur(p), _end(end) {
+    // the first two points are the corners of the bounding box
+    util::geo::DPoint ll, ur;
+    nextVertex(&ll);
+    nextVertex(&ur);
+    _bbox = util::geo::DBox(ll, ur);
+  }
+
+  // read the compressed line at p
+  explicit LineReader(const uint8_t* p) : _compressed(true) {
+    uint8_t flags;
+    LineCoord ur;
+    _bytes = lineDecodeHeader(p, &_left, &flags, &_prev, &ur);
+    _bbox = util::geo::DBox(
+        util::geo::DPoint(_prev.getX() / 10.0, _prev.getY() / 10.0),
+        util::geo::DPoint(ur.getX() / 10.0, ur.getY() / 10.0));
+  }
+
+  const util::geo::DBox& getBBox() const { return _bbox; }
+
+  // additionally return points at distance d, 2d, ... from the start of
+  // each segment, as util::geo::densify() does, but without materializing
+  // the line
+  void densify(double d) { _dens = d; }
+
+  // writes the next point to p, false at the end of the line
+  bool next(util::geo::DPoint* p) {
+    if (_dens <= 0) return nextVertex(p);
+
+    if (_segPos < _segLen) {
+      *p = util::geo::DPoint(_segA.getX() + _segDx * _segPos,
+                             _segA.getY() + _segDy * _segPos);
+      _segPos += _dens;
+      return true;
+    }
+
+    if (_segEnd) {
+      _segEnd = false;
+      _segA = _segB;
+      *p = _segB;
+      return true;
+    }
+
+    if (!nextVertex(&_segB)) return false;
+
+    if (!_segStarted) {
+      _segStarted = true;
+      _segA = _segB;
+      *p = _segB;
+      return true;
+    }
+
+    _segLen = util::geo::dist(_segA, _segB);
+    _segDx = (_segB.getX() - _segA.getX()) / _segLen;
+    _segDy = (_segB.getY() - _segA.getY()) / _segLen;
+    _segPos = _dens;
+    _segEnd = true;
+    return next(p);
+  }
+
+ private:
+  bool nextVertex(util::geo::DPoint* p) {
+    if (_compressed) {
+      if (_pos == _num) {
+        if (_left == 0) return false;
+        _num = std::min(_left, LINE_BLOCK);
+        _bytes = lineDecode(_bytes, _num, &_prev, _buf);
+        _left -= _num;
+        _pos = 0;
+      }
+      const auto& cur = _buf[_pos++];
+      *p = util::geo::DPoint(cur.getX() / 10.0, cur.getY() / 10.0);
+      return true;
+    }
+
+    for (; _cur < _end; _cur++) {
+      if (isMCoord(_cur->getX())) {
+        _mainX = rmCoord(_cur->getX());
+        _mainY = rmCoord(_cur->getY());
+        continue;
+      }
+
+      *p = util::geo::DPoint(
+          (_mainX * M_COORD_GRANULARITY + _cur->getX()) / 10.0,
+          (_mainY * M_COORD_GRANULARITY + _cur->getY()) / 10.0);
+      _cur++;
+      return true;
+    }
+    return false;
+  }
+
+  bool _compressed = false;
+
+  // plain line
+  const util::geo::Point<int16_t>* _cur = 0;
+  const util::geo::Point<int16_t>* _end = 0;
+  double _mainX = 0;
+  double _mainY = 0;
+
+  // compressed line, decoded block by block
+  const uint8_t* _bytes = 0;
+  size_t _left = 0;
+  LineCoord _prev;
+  LineCoord _buf[LINE_BLOCK];
+  size_t _pos = 0;
+  size_t _num = 0;
+
+  util::geo::DBox _bbox;
+
+  // lazy densification of the current segment _segA - _segB
+  double _dens = 0;
+  bool _segStarted = false;
+  bool _segEnd = false;
+  util::geo::DPoint _segA, _segB;
+  double _segLen = 0;
+  double _segPos = 0;
+  double _segDx = 0;
+  double _segDy = 0;
+};
+
+}  // namespace petrimaps
+
+#endif  // PETRIMAPS_LINECODEC_H_
@@ -0,0 +1,179 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#ifndef PETRIMAPS_MAPPEDARRAY_H_
+#define PETRIMAPS_MAPPEDARRAY_H_
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+namespace petrimaps {
+
+// Growable array of trivially copyable elements in anonymous memory
+// mappings. On growth, the pages are re-mapped instead of copied, so large
+// arrays can be filled by appending without a second copy in memory. The
+// array may also be a private view into a file, which is copied into
+// anonymous memory only once it has to grow.
+template <typename T>
+class MappedArray {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "MappedArray requires trivially copyable elements");
+
+ public:
+  MappedArray() {}
+  ~MappedArray() { unmap(); }
+
+  MappedArray(const MappedArray&) = delete;
+  MappedArray& operator=(const MappedArray&) = delete;
+
+  MappedArray(MappedArray&& o)
+      : _data(o._data), _size(o._size), _cap(o._cap), _file(o._file) {
+    o._data = 0;
+    o._size = 0;
+    o._cap = 0;
+    o._file = false;
+  }
+
+  MappedArray& operator=(MappedArray&& o) {
+    if (this == &o) return *this;
+    unmap();
+    _data = o._data;
+    _size = o._size;
+    _cap = o._cap;
+    _file = o._file;
+    o._data = 0;
+    o._size = 0;
+    o._cap = 0;
+    o._file = false;
+    return *this;
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  T* data() { return _data; }
+  const T* data() const { return _data; }
+
+  T* begin() { return _data; }
+  T* end() { return _data + _size; }
+  const T* begin() const { return _data; }
+  const T* end() const { return _data + _size; }
+
+  T& operator[](size_t i) { return _data[i]; }
+  const T& operator[](size_t i) const { return _data[i]; }
+
+  T& back() { return _data[_size - 1]; }
+  const T& back() const { return _data[_size - 1]; }
+
+  void push_back(const T& v) { append(&v, 1); }
+
+  void append(const T* v, size_t n) {
+    if (n == 0) return;
+    if (_size + n > _cap) reserve(std::max(_size + n, 2 * _cap));
+    memcpy(static_cast<void*>(_data + _size), v, n * sizeof(T));
+    _size += n;
+  }
+
+  // new elements are zero-initialized
+  void resize(size_t n) {
+    if (n > _cap) reserve(n);
+    if (n > _size) {
+      memset(static_cast<void*>(_data + _size), 0, (n - _size) * sizeof(T));
+    }
+    _size = n;
+  }
+
+  void reserve(size_t n) {
+    if (n <= _cap) return;
+
+    size_t bytes = mapSize(n);
+
+    void* p;
+    if (_file) {
+      // never grow a file mapping, writes beyond the file end would fault
+      p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+      if (p != MAP_FAILED) {
+        memcpy(p, static_cast<void*>(_data), _size * sizeof(T));
+        munmap(_data, mapSize(_cap));
+        _file = false;
+      }
+    } else if (_data) {
+#ifdef MREMAP_MAYMOVE
+      p = mremap(_data, mapSize(_cap), bytes, MREMAP_MAYMOVE);
+#else
+      p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+      if (p != MAP_FAILED) {
+        memcpy(p, static_cast<void*>(_data), _size * sizeof(T));
+        munmap(_data, mapSize(_cap));
+      }
+#endif
+    } else {
+      p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    }
+
+    if (p == MAP_FAILED) throw std::bad_alloc();
+
+    _data = static_cast<T*>(p);
+    _cap = bytes / sizeof(T);
+  }
+
+  // map n elements at offset (which must be page aligned) of the file fd,
+  // changes are private to this array and never written to the file
+  void mapFile(int fd, size_t offset, size_t n) {
+    free();
+    if (n == 0) return;
+
+    void* p = mmap(0, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                   offset);
+    if (p == MAP_FAILED) throw std::runtime_error("Could not map file");
+
+    // start reading ahead, the arrays are usually scanned in full
+    madvise(p, n * sizeof(T), MADV_WILLNEED);
+
+    _data = static_cast<T*>(p);
+    _size = n;
+    _cap = n;
+    _file = true;
+  }
+
+  // the mapping is kept
+  void clear() { _size = 0; }
+
+  // release the mapping
+  void free() {
+    unmap();
+    _size = 0;
+  }
+
+ private:
+  T* _data = 0;
+  size_t _size = 0;
+  size_t _cap = 0;
+  bool _file = false;
+
+  static size_t mapSize(size_t n) {
+    size_t page = sysconf(_SC_PAGE_SIZE);
+    return ((n * sizeof(T) + page - 1) / page) * page;
+  }
+
+  void unmap() {
+    if (_data) munmap(_data, mapSize(_cap));
+    _data = 0;
+    _cap = 0;
+    _file = false;
+  }
+};
+
+}  // namespace petrimaps
+
+#endif  // PETRIMAPS_MAPPEDARRAY_H_
@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -251,24 +252,44 @@ size_t RequestReader::writeCbIds(void* contents, size_t size, size_t nmemb,
 
 // _____________________________________________________________________________
 void RequestReader::parseIds(const char* c, size_t size) {
-  // TODO: just a rough approximation
-  checkMem(size, _maxMemory);
+  if (_raw.size() < 10000) _raw.append(c, std::min(size, 10000 - _raw.size()));
 
-  for (size_t i = 0; i < size; i++) {
-    if (_raw.size() < 10000) _raw.push_back(c[i]);
-    _curId.bytes[_curByte] = c[i];
+  if (_ids.capacity() == 0) {
+    // the uncompressed stream holds at least Content-Length bytes
+    curl_off_t len = -1;
+    curl_easy_getinfo(_curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+    if (len > 0) _idBytes += reserveCharged(&_ids, len / 8, _memory);
+  }
+
+  // all ids completed in this callback fit without reallocation
+  _idBytes += reserveCharged(&_ids, _ids.size() + (_curByte + size) / 8,
+                             _memory);
+
+  // complete the id started in the previous callback
+  while (_curByte != 0 && size > 0) {
+    _curId.bytes[_curByte] = *c;
     _curByte = (_curByte + 1) % 8;
+    c++;
+    size--;
+    if (_curByte == 0) _ids.push_back({_curId.val, _ids.size()});
+  }
 
-    if (_curByte == 0) {
-      _ids.push_back({_curId.val, _ids.size()});
-    }
+  // whole ids are read directly from the buffer
+  for (; size >= 8; c += 8, size -= 8) {
+    uint64_t val;
+    memcpy(&val, c, 8);
+    _ids.push_back({val, _ids.size()});
   }
+
+  // keep an incomplete id for the next callback
+  for (; size > 0; c++, size--) _curId.bytes[_curByte++] = *c;
 }
 
 // _____________________________________________________________________________
 void RequestReader::parse(const char* c, size_t size) {
-  // TODO: just a rough approximation
-  checkMem(size, _maxMemory);
+  // TODO: just a rough approximation of the memory of the parsed rows
+  if (_memory) _memory->charge(size);
+  _rowBytes += size;
 
   const char* start = c;
   while (c < start + size) {
@@ -313,3 +334,10 @@ void RequestReader::parse(const char* c, size_t size) {
     }
   }
 }
+
+// _____________________________________________________________________________
+void RequestReader::clearRows() {
+  rows = {};
+  if (_memory) _memory->release(_rowBytes);
+  _rowBytes = 0;
+}
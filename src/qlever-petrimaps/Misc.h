@@ -5,6 +5,8 @@
 #include <curl/curl.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -27,6 +29,38 @@ const static size_t MAXROWS = 18446744073709551615u;
 const static int16_t M_COORD_GRANULARITY = 12230;
 const static int16_t M_COORD_OFFSET = 16384;
 
+// maximum distance between the points of a line added to the line point
+// grid, the 200 is the THRESHOLD from Server.cpp
+const static double LINE_POINT_DIST = 200 * 3;
+
+// the point and line grids of a result are sized for about GRID_CELL_OBJS
+// objects per cell, with cell sizes between GRID_MIN_CELL_SIZE and
+// GRID_MAX_CELL_SIZE. Cells with more than GRID_MAX_CELL values are split.
+const static size_t GRID_CELL_OBJS = 64;
+const static size_t GRID_MAX_CELL = 1024;
+const static double GRID_MIN_CELL_SIZE = 1 << 10;
+const static double GRID_MAX_CELL_SIZE = 1 << 20;
+
+// lines are added to every cell their bounding box touches, so smaller line
+// grid cells would multiply the entries of long lines. Dense line cells are
+// split instead.
+const static double GRID_MIN_LINE_CELL_SIZE = 1 << 16;
+
+// cell size of the line point grid, its points are stored with a
+// precision of 1/256 of this
+const static double LINE_POINT_GRID_SIZE = 65536;
+
+// the grids are filled from one slice of the objects per thread, with at
+// least GRID_MIN_SLICE objects, or LINE_POINT_MIN_SLICE objects for the line
+// point grid
+const static size_t GRID_MIN_SLICE = 1 << 14;
+const static size_t LINE_POINT_MIN_SLICE = 1 << 10;
+
+// cell size of the finest level of the count pyramids used for low zoom
+// heatmaps, and the minimum number of values per cell of a level
+const static double PYRAMID_MIN_CELL_SIZE = 1024;
+const static size_t PYRAMID_MIN_AGGREGATION = 4;
+
 namespace petrimaps {
 
 enum ParseState { IN_HEADER, IN_ROW };
@@ -78,21 +112,86 @@ class OutOfMemoryError : public std::exception {
   std::string _msg;
 };
 
-inline void checkMem(size_t want, size_t max) {
-  size_t currentSize = util::getCurrentRSS();
+// Accounting of the memory used by large allocations. Allocations are
+// charged to a budget before they are made, which fails with an
+// OutOfMemoryError if the budget would exceed its limit. Budgets can be nested
+// (e.g. one per session below a global one), a charge to a budget is also a
+// charge to its parent.
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(size_t max) : _max(max), _parent(0) {}
+  MemoryBudget(size_t max, MemoryBudget* parent)
+      : _max(max), _parent(parent) {}
+  MemoryBudget(const MemoryBudget&) = delete;
+  ~MemoryBudget() {
+    if (_parent) _parent->release(_used);
+  }
+
+  // charge want bytes, throws an OutOfMemoryError if this would exceed the
+  // limit of this budget or of one of its parents
+  void charge(size_t want) {
+    size_t have = _used.fetch_add(want);
+    if (have + want > _max) {
+      _used -= want;
+      throw OutOfMemoryError(want, have, _max);
+    }
+
+    if (!_parent) return;
+
+    try {
+      _parent->charge(want);
+    } catch (...) {
+      _used -= want;
+      throw;
+    }
+  }
+
+  // charge bytes which are already allocated, never fails
+  void add(size_t bytes) {
+    _used += bytes;
+    if (_parent) _parent->add(bytes);
+  }
 
-  if (currentSize + want > max) {
-    throw OutOfMemoryError(want, currentSize, max);
+  void release(size_t bytes) {
+    _used -= bytes;
+    if (_parent) _parent->release(bytes);
   }
+
+  size_t used() const { return _used; }
+  size_t max() const { return _max; }
+
+ private:
+  std::atomic<size_t> _used{0};
+  size_t _max;
+  MemoryBudget* _parent;
+};
+
+// _____________________________________________________________________________
+template <typename T>
+size_t reserveCharged(std::vector<T>* vec, size_t n, MemoryBudget* memory) {
+  // make room for n elements in vec, the growth is charged to memory before
+  // it is allocated, returns the number of charged bytes
+  if (n <= vec->capacity()) return 0;
+  n = std::max(n, 2 * vec->capacity());
+  size_t bytes = (n - vec->capacity()) * sizeof(T);
+  if (memory) memory->charge(bytes);
+  try {
+    vec->reserve(n);
+  } catch (...) {
+    // nothing was allocated
+    if (memory) memory->release(bytes);
+    throw;
+  }
+  return bytes;
 }
 
 struct RequestReader {
-  explicit RequestReader(const std::string& backendUrl, size_t maxMemory)
-      : _backendUrl(backendUrl),
-        _curl(curl_easy_init()),
-        _maxMemory(maxMemory) {}
+  // the buffers of the reader are charged to memory, if given
+  explicit RequestReader(const std::string& backendUrl, MemoryBudget* memory)
+      : _backendUrl(backendUrl), _curl(curl_easy_init()), _memory(memory) {}
   ~RequestReader() {
     if (_curl) curl_easy_cleanup(_curl);
+    if (_memory) _memory->release(_idBytes + _rowBytes);
   }
 
   std::vector<std::string> requestColumns(const std::string& query);
@@ -102,6 +201,7 @@ struct RequestReader {
                    size_t (*writeCb)(void*, size_t, size_t, void*), void* ptr);
   void parse(const char*, size_t size);
   void parseIds(const char*, size_t size);
+  void clearRows();
 
   static size_t writeStringCb(void* contents, size_t size, size_t nmemb,
                               void* userp);
@@ -128,7 +228,11 @@ struct RequestReader {
   ID _curId;
   size_t _received = 0;
   std::vector<IdMapping> _ids;
-  size_t _maxMemory;
+
+  MemoryBudget* _memory;
+  size_t _idBytes = 0;
+  size_t _rowBytes = 0;
+
   std::exception_ptr exceptionPtr;
 };
 
@@ -0,0 +1,76 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#ifndef PETRIMAPS_OFFSETINDEX_H_
+#define PETRIMAPS_OFFSETINDEX_H_
+
+#include <stdint.h>
+
+#include <limits>
+#include <stdexcept>
+
+#include "qlever-petrimaps/MappedArray.h"
+
+namespace petrimaps {
+
+static const size_t OFFSET_BLOCK_BITS = 6;
+static const size_t OFFSET_BLOCK = 1 << OFFSET_BLOCK_BITS;
+
+// Non-decreasing offsets (e.g. of the lines into their points) in a little
+// more than 4 bytes each. The full offset of the first entry of each block
+// of OFFSET_BLOCK entries is kept in a base table, all entries are stored as
+// 32 bit offsets relative to the base of their block.
+class OffsetIndex {
+ public:
+  size_t size() const { return _offsets.size(); }
+  bool empty() const { return _offsets.empty(); }
+
+  size_t operator[](size_t i) const {
+    return _bases[i >> OFFSET_BLOCK_BITS] + _offsets[i];
+  }
+
+  void push_back(size_t off) {
+    if ((_offsets.size() & (OFFSET_BLOCK - 1)) == 0) _bases.push_back(off);
+    if (off < _bases.back() ||
+        off - _bases.back() > std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error("Offset out of range of offset index");
+    }
+    _offsets.push_back(off - _bases.back());
+  }
+
+  // the mappings are kept
+  void clear() {
+    _offsets.clear();
+    _bases.clear();
+  }
+
+  // release the mappings
+  void free() {
+    _offsets.free();
+    _bases.free();
+  }
+
+  // whether the base table matches the offsets, e.g. after mapping both
+  // from a file
+  bool valid() const {
+    return _bases.size() == (_offsets.size() + OFFSET_BLOCK - 1) / OFFSET_BLOCK;
+  }
+
+  size_t bytes() const {
+    return _offsets.size() * sizeof(uint32_t) + _bases.size() * sizeof(size_t);
+  }
+
+  MappedArray<uint32_t>& offsets() { return _offsets; }
+  const MappedArray<uint32_t>& offsets() const { return _offsets; }
+  MappedArray<size_t>& bases() { return _bases; }
+  const MappedArray<size_t>& bases() const { return _bases; }
+
+ private:
+  MappedArray<uint32_t> _offsets;
+  MappedArray<size_t> _bases;
+};
+
+}  // namespace petrimaps
+
+#endif  // PETRIMAPS_OFFSETINDEX_H_
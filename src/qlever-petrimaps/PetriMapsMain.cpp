@@ -4,7 +4,11 @@
 
 #include <curl/curl.h>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "qlever-petrimaps/server/Server.h"
 #include "util/Misc.h"
@@ -17,14 +21,41 @@ using petrimaps::Server;
 void printHelp(int argc, char** argv) {
   UNUSED(argc);
   std::cout << "Usage: " << argv[0]
-            << " [-p <port>] [-m <maxmemory>] [-c <cachedir>] [--help] [-h]"
-            << "\n";
+            << " [-p <port>] [-m <maxmemory>] [-c <cachedir>] [-f <num>]"
+            << " [-l <file>] [-j <num>] [-z] [-s] [--help] [-h]\n";
   std::cout
       << "\nAllowed arguments:\n    -p <port>    Port for server to listen to "
          "(default: 9090)"
       << "\n    -m <memory>  Max memory in GB (default: 90% of system RAM)"
       << "\n    -c <dir>     cache dir (default: none)"
-      << "\n    -t <minutes> request cache lifetime (default: 360)\n";
+      << "\n    -t <minutes> request cache lifetime (default: 360)"
+      << "\n    -f <num>     parallel requests during cache fill (default: 4)"
+      << "\n    -l <file>    file listing backends (one per line) to load at"
+         " startup (default: none)"
+      << "\n    -j <num>     backends loaded concurrently at startup (default: "
+         "1)"
+      << "\n    -z           keep line geometries compressed in memory"
+      << "\n    -s           order geometries spatially after a cache fill\n";
+}
+
+// _____________________________________________________________________________
+std::vector<std::string> readBackends(const std::string& fname) {
+  std::ifstream f(fname);
+  if (!f.good()) {
+    LOG(ERROR) << "Could not open backend list " << fname;
+    exit(1);
+  }
+
+  std::vector<std::string> backends;
+  std::string line;
+  while (std::getline(f, line)) {
+    line = util::trim(line);
+    // skip empty lines and comments
+    if (line.empty() || line[0] == '#') continue;
+    backends.push_back(line);
+  }
+
+  return backends;
 }
 
 // _____________________________________________________________________________
@@ -41,6 +72,11 @@ int main(int argc, char** argv) {
   // default port
   int port = 9090;
   int cacheLifetime = 6 * 60;
+  int fillRequests = 4;
+  int preloadThreads = 1;
+  bool compressLines = false;
+  bool hilbertOrder = false;
+  std::string preloadFile;
   double maxMemoryGB =
       (sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) * 0.9) / 1000000000;
   std::string cacheDir;
@@ -74,6 +110,28 @@ int main(int argc, char** argv) {
         exit(1);
       }
       cacheLifetime = atof(argv[i]);
+    } else if (cur == "-f") {
+      if (++i >= argc) {
+        LOG(ERROR) << "Missing argument for fill requests (-f).";
+        exit(1);
+      }
+      fillRequests = std::max(1, atoi(argv[i]));
+    } else if (cur == "-l") {
+      if (++i >= argc) {
+        LOG(ERROR) << "Missing argument for backend list (-l).";
+        exit(1);
+      }
+      preloadFile = argv[i];
+    } else if (cur == "-j") {
+      if (++i >= argc) {
+        LOG(ERROR) << "Missing argument for startup loads (-j).";
+        exit(1);
+      }
+      preloadThreads = std::max(1, atoi(argv[i]));
+    } else if (cur == "-z") {
+      compressLines = true;
+    } else if (cur == "-s") {
+      hilbertOrder = true;
     }
   }
 
@@ -85,7 +143,15 @@ int main(int argc, char** argv) {
 
   LOG(INFO) << "Starting server...";
   LOG(INFO) << "Max memory is " << maxMemoryGB << " GB...";
-  Server serv(maxMemoryGB * 1000000000, cacheDir, cacheLifetime);
+  Server serv(maxMemoryGB * 1000000000, cacheDir, cacheLifetime, fillRequests,
+              compressLines, hilbertOrder);
+
+  if (preloadFile.size()) {
+    auto backends = readBackends(preloadFile);
+    LOG(INFO) << "Loading " << backends.size() << " backends from "
+              << preloadFile << " in the background...";
+    serv.preload(backends, preloadThreads);
+  }
 
   LOG(INFO) << "Listening on port " << port;
   util::http::HttpServer(port, &serv, std::thread::hardware_concurrency())
@@ -0,0 +1,122 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#ifndef PETRIMAPS_RADIXSORT_H_
+#define PETRIMAPS_RADIXSORT_H_
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "qlever-petrimaps/Misc.h"
+
+namespace petrimaps {
+
+static const size_t RADIX_BITS = 11;
+static const size_t RADIX_BUCKETS = 1 << RADIX_BITS;
+
+// below this size, a comparison sort is faster
+static const size_t RADIX_MIN_SIZE = 1 << 16;
+
+// minimum number of elements per thread
+static const size_t RADIX_MIN_BLOCK = 1 << 16;
+
+// _____________________________________________________________________________
+template <typename T, typename Key>
+void radixSort(T* a, size_t n, Key key, size_t numThreads) {
+  // Stable LSD radix sort of a by the 32 bit key(a[i]). Each thread owns a
+  // contiguous block of the input in every pass, and the blocks are
+  // scattered in order, which keeps the sort stable.
+  if (n < RADIX_MIN_SIZE) {
+    std::stable_sort(a, a + n, [&key](const T& x, const T& y) {
+      return key(x) < key(y);
+    });
+    return;
+  }
+
+  numThreads = std::max<size_t>(1, std::min(numThreads, n / RADIX_MIN_BLOCK));
+  size_t blockSize = (n + numThreads - 1) / numThreads;
+
+  // only the digits up to the highest set bit of the largest key are sorted
+  std::vector<uint32_t> maxKeys(numThreads, 0);
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+  for (size_t t = 0; t < numThreads; t++) {
+    uint32_t m = 0;
+    for (size_t i = t * blockSize; i < std::min(n, (t + 1) * blockSize); i++) {
+      m = std::max<uint32_t>(m, key(a[i]));
+    }
+    maxKeys[t] = m;
+  }
+  uint32_t maxKey = *std::max_element(maxKeys.begin(), maxKeys.end());
+
+  std::unique_ptr<T[]> buf(new T[n]);
+  T* src = a;
+  T* dst = buf.get();
+
+  std::vector<size_t> hist(numThreads * RADIX_BUCKETS);
+
+  for (size_t shift = 0; shift < 32 && (maxKey >> shift) > 0;
+       shift += RADIX_BITS) {
+    std::fill(hist.begin(), hist.end(), 0);
+
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+    for (size_t t = 0; t < numThreads; t++) {
+      size_t* h = &hist[t * RADIX_BUCKETS];
+      for (size_t i = t * blockSize; i < std::min(n, (t + 1) * blockSize);
+           i++) {
+        h[(key(src[i]) >> shift) & (RADIX_BUCKETS - 1)]++;
+      }
+    }
+
+    // all keys share this digit, nothing to do
+    size_t b0 = (key(src[0]) >> shift) & (RADIX_BUCKETS - 1);
+    size_t cnt0 = 0;
+    for (size_t t = 0; t < numThreads; t++) {
+      cnt0 += hist[t * RADIX_BUCKETS + b0];
+    }
+    if (cnt0 == n) continue;
+
+    // turn the counts into the start offsets of each thread in each bucket
+    size_t off = 0;
+    for (size_t b = 0; b < RADIX_BUCKETS; b++) {
+      for (size_t t = 0; t < numThreads; t++) {
+        size_t cnt = hist[t * RADIX_BUCKETS + b];
+        hist[t * RADIX_BUCKETS + b] = off;
+        off += cnt;
+      }
+    }
+
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+    for (size_t t = 0; t < numThreads; t++) {
+      size_t* h = &hist[t * RADIX_BUCKETS];
+      for (size_t i = t * blockSize; i < std::min(n, (t + 1) * blockSize);
+           i++) {
+        dst[h[(key(src[i]) >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+      }
+    }
+
+    std::swap(src, dst);
+  }
+
+  if (src != a) {
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+    for (size_t t = 0; t < numThreads; t++) {
+      size_t start = std::min(n, t * blockSize);
+      size_t end = std::min(n, (t + 1) * blockSize);
+      memcpy(static_cast<void*>(a + start), src + start,
+             (end - start) * sizeof(T));
+    }
+  }
+}
+
+// _____________________________________________________________________________
+inline void radixSort(IdMapping* a, size_t n, size_t numThreads) {
+  // stable sort by qlever id
+  radixSort(a, n, [](const IdMapping& m) { return m.qid; }, numThreads);
+}
+
+}  // namespace petrimaps
+
+#endif  // PETRIMAPS_RADIXSORT_H_
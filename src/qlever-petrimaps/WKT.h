@@ -0,0 +1,181 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#ifndef PETRIMAPS_WKT_H_
+#define PETRIMAPS_WKT_H_
+
+#include <strings.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "util/geo/Geo.h"
+
+namespace petrimaps {
+
+static const double WKT_POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5,
+                                   1e6, 1e7, 1e8, 1e9, 1e10};
+
+// maximum number of decimal places evaluated, as in util::atof(p, 10)
+static const uint8_t WKT_MAX_DECIMALS = 10;
+
+// _____________________________________________________________________________
+inline bool wktIsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
+}
+
+// _____________________________________________________________________________
+inline const char* wktPrefix(const char* p, const char* end,
+                             const char* prefix) {
+  // Returns the position after prefix if the string at p starts with it,
+  // ignoring case, or 0 otherwise.
+  size_t len = strlen(prefix);
+  if (static_cast<size_t>(end - p) < len || strncasecmp(p, prefix, len) != 0)
+    return 0;
+  return p + len;
+}
+
+// _____________________________________________________________________________
+inline const char* wktFind(const char* p, const char* end, char c) {
+  // Returns the position of the first c in [p, end), or 0.
+  if (p >= end) return 0;
+  return static_cast<const char*>(memchr(p, c, end - p));
+}
+
+// _____________________________________________________________________________
+inline size_t wktDigits(const char* p, const char* end, uint64_t* val) {
+  // Reads the run of (at most 8) decimal digits at p into val, and returns
+  // its length. 8 bytes are checked at once if they are available.
+  if (end - p < 8 || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+    size_t n = 0;
+    *val = 0;
+    while (n < 8 && p + n < end && p[n] >= '0' && p[n] <= '9') {
+      *val = *val * 10 + (p[n] - '0');
+      n++;
+    }
+    return n;
+  }
+
+  uint64_t v;
+  memcpy(&v, p, 8);
+
+  // the high bit of each non-digit byte is set in either of those, carries
+  // and borrows only propagate from the first non-digit byte onwards
+  uint64_t nonDigits =
+      ((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) &
+      0x8080808080808080ULL;
+
+  size_t n = nonDigits ? __builtin_ctzll(nonDigits) / 8 : 8;
+  if (n == 0) {
+    *val = 0;
+    return 0;
+  }
+
+  // move the digits to the most significant bytes, which the conversion
+  // below treats as the last digits
+  v -= 0x3030303030303030ULL;
+  if (n < 8) v <<= 8 * (8 - n);
+
+  v = (v * 10) + (v >> 8);
+  v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+       (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >>
+      32;
+
+  *val = v;
+  return n;
+}
+
+// _____________________________________________________________________________
+inline const char* parseCoord(const char* p, const char* end, double* ret) {
+  // Parses a coordinate exactly as util::atof(p, 10) does, and returns the
+  // position after it.
+  while (p < end && wktIsSpace(*p)) p++;
+
+  bool neg = false;
+  if (p < end && *p == '-') {
+    neg = true;
+    p++;
+  }
+
+  // the integer part, digit for digit as util::atof does for very long runs
+  double integ = 0;
+  uint64_t v;
+  size_t n;
+  size_t total = 0;
+  while ((n = wktDigits(p, end, &v)) > 0) {
+    if (total + n > 15) {
+      for (size_t i = 0; i < n; i++) integ = integ * 10.0 + (p[i] - '0');
+    } else {
+      integ = integ * WKT_POW10[n] + v;
+    }
+    total += n;
+    p += n;
+    if (n < 8) break;
+  }
+
+  if (p < end && *p == '.') {
+    p++;
+
+    uint64_t f = 0;
+    size_t decimals = 0;
+    while (decimals < WKT_MAX_DECIMALS &&
+           (n = wktDigits(p, end, &v)) > 0) {
+      if (decimals + n > WKT_MAX_DECIMALS) {
+        n = WKT_MAX_DECIMALS - decimals;
+        v = 0;
+        for (size_t i = 0; i < n; i++) v = v * 10 + (p[i] - '0');
+      }
+      f = f * static_cast<uint64_t>(WKT_POW10[n]) + v;
+      decimals += n;
+      p += n;
+      if (n < 8) break;
+    }
+
+    integ += static_cast<double>(f) / WKT_POW10[decimals];
+
+    // skip decimals beyond the evaluated ones
+    while (p < end && *p >= '0' && *p <= '9') p++;
+  }
+
+  *ret = neg ? -integ : integ;
+  return p;
+}
+
+// _____________________________________________________________________________
+inline const char* parseCoords(const char* p, const char* end,
+                               util::geo::DLine* line) {
+  // Parses the WKT coordinate list at p up to the closing parenthesis into
+  // line as (lng, lat) pairs, and returns the position of the parenthesis.
+  // Additional dimensions are skipped.
+  while (true) {
+    double x, y;
+    p = parseCoord(p, end, &x);
+    p = parseCoord(p, end, &y);
+    line->push_back(util::geo::DPoint(x, y));
+
+    while (p < end && *p != ',' && *p != ')') p++;
+    if (p == end || *p == ')') break;
+    p++;
+  }
+
+  return p;
+}
+
+// _____________________________________________________________________________
+inline void projectCoords(util::geo::DLine* line) {
+  // Projects (lng, lat) pairs to web mercator in place, with the same
+  // formula as util::geo::latLngToWebMerc, but with a single sin() per
+  // vertex.
+  for (auto& p : *line) {
+    double x = 6378137.0 * p.getX() * 0.017453292519943295;
+    double s = sin(p.getY() * 0.017453292519943295);
+    p = util::geo::DPoint(x, 3189068.5 * log((1.0 + s) / (1.0 - s)));
+  }
+}
+
+}  // namespace petrimaps
+
+#endif  // PETRIMAPS_WKT_H_
@@ -0,0 +1,694 @@
+// Copyright 2022, University of Freiburg,
+// Chair of Algorithms and Data Structures.
+// Authors: Patrick Brosi <brosi@informatik.uni-freiburg.de>
+
+#include <curl/curl.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qlever-petrimaps/GeomCache.h"
+#include "qlever-petrimaps/Grid.h"
+#include "qlever-petrimaps/Misc.h"
+#include "qlever-petrimaps/RadixSort.h"
+#include "qlever-petrimaps/WKT.h"
+#include "util/Misc.h"
+#include "util/geo/Geo.h"
+#include "util/log/Log.h"
+
+// Benchmarks of the geometry parsing and of the in-memory layout, on
+// synthetic data. Built with -DPETRIMAPS_BENCH=ON.
+
+using petrimaps::GeomCache;
+using petrimaps::IdMapping;
+using util::geo::DLine;
+using util::geo::DPoint;
+using util::geo::FBox;
+
+// _____________________________________________________________________________
+void printHelp(int argc, char** argv) {
+  UNUSED(argc);
+  std::cout << "Usage: " << argv[0]
+            << " [-n <num>] [--help] [-h] <benchmark>\n";
+  std::cout
+      << "\nBenchmarks:\n    wkt          parse and project a linestring of"
+         " n vertices (default: 2M)"
+      << "\n    radix        sort n qid mappings of four distributions by"
+         " radix sort and\n                 std::stable_sort (default: 30M)"
+      << "\n    lines        fill n buildings and roads with plain and with"
+         " compressed\n                 lines, and decode all lines (default:"
+         " 1M)"
+      << "\n    densify      fill n roads into a cache dir and densify their"
+         " lines\n                 (default: 200k)"
+      << "\n    hilbert      fill n clustered points in fill and in Hilbert"
+         " order and\n                 replay viewports on their point grid"
+         " (default: 20M)"
+      << "\n\nAllowed arguments:\n    -n <num>     input size (default: see"
+         " above)\n";
+}
+
+// A minimal local QLever backend, which answers the count, fill and id
+// queries of a GeomCache with the given WKT geometries, in their sort order.
+class BenchBackend {
+ public:
+  explicit BenchBackend(std::vector<std::string> rows);
+  ~BenchBackend();
+
+  std::string getUrl() const {
+    return "http://127.0.0.1:" + std::to_string(_port) + "/bench";
+  }
+
+ private:
+  void serve() const;
+  std::string answer(const std::string& req) const;
+
+  // the rows, row i is [_offsets[i], _offsets[i + 1]) of _rows
+  std::string _rows;
+  std::vector<size_t> _offsets;
+
+  int _sock;
+  int _port;
+  std::thread _thread;
+};
+
+// _____________________________________________________________________________
+BenchBackend::BenchBackend(std::vector<std::string> rows) {
+  std::sort(rows.begin(), rows.end());
+  _offsets.push_back(0);
+  for (auto& row : rows) {
+    _rows += "\"" + row;
+    _rows += "\"^^<http://www.opengis.net/ont/geosparql#wktLiteral>\n";
+    _offsets.push_back(_rows.size());
+    std::string().swap(row);
+  }
+
+  _sock = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t len = sizeof(addr);
+  if (_sock < 0 ||
+      bind(_sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(_sock, 64) != 0 ||
+      getsockname(_sock, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    throw std::runtime_error("Could not start the benchmark backend");
+  }
+  _port = ntohs(addr.sin_port);
+
+  _thread = std::thread(&BenchBackend::serve, this);
+}
+
+// _____________________________________________________________________________
+BenchBackend::~BenchBackend() {
+  shutdown(_sock, SHUT_RDWR);
+  close(_sock);
+  _thread.join();
+}
+
+// _____________________________________________________________________________
+void BenchBackend::serve() const {
+  // one request per connection, answered in order
+  while (true) {
+    int conn = accept(_sock, 0, 0);
+    if (conn < 0) return;
+
+    std::string req;
+    char buf[4096];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      ssize_t r = read(conn, buf, sizeof(buf));
+      if (r <= 0) break;
+      req.append(buf, r);
+    }
+
+    std::string body = answer(req);
+    std::string resp = body.empty() ? "HTTP/1.0 400 Bad Request\r\n"
+                                    : "HTTP/1.0 200 OK\r\n";
+    resp += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    resp += body;
+
+    for (size_t sent = 0; sent < resp.size();) {
+      ssize_t r =
+          send(conn, resp.data() + sent, resp.size() - sent, MSG_NOSIGNAL);
+      if (r <= 0) break;
+      sent += r;
+    }
+    close(conn);
+  }
+}
+
+// _____________________________________________________________________________
+std::string BenchBackend::answer(const std::string& req) const {
+  size_t numRows = _offsets.size() - 1;
+  std::string target = req.substr(0, req.find(" HTTP/"));
+
+  if (target.find("cmd=get-index-id") != std::string::npos) return "bench";
+
+  size_t pos = target.find("query=");
+  if (pos == std::string::npos) return "";
+  pos += 6;
+  size_t end = std::min(target.find('&', pos), target.size());
+  int len = 0;
+  char* q = curl_easy_unescape(0, target.c_str() + pos, end - pos, &len);
+  std::string query(q, len);
+  curl_free(q);
+
+  // the hash query of incremental refreshes is not supported
+  if (query.find("MD5(") != std::string::npos) return "";
+
+  if (query.find("COUNT(") != std::string::npos) {
+    return "?count\n" + std::to_string(numRows) + "\n";
+  }
+
+  if (req.find("application/octet-stream") != std::string::npos) {
+    // the qlever id of row i is i + 1
+    std::string ret(numRows * 8, 0);
+    for (size_t i = 0; i < numRows; i++) {
+      uint64_t id = i + 1;
+      memcpy(&ret[i * 8], &id, 8);
+    }
+    return ret;
+  }
+
+  size_t limit = numRows;
+  size_t offset = 0;
+  pos = query.find(" LIMIT ");
+  if (pos != std::string::npos) limit = std::stoull(query.substr(pos + 7));
+  pos = query.find(" OFFSET ");
+  if (pos != std::string::npos) offset = std::stoull(query.substr(pos + 8));
+
+  size_t first = std::min(offset, numRows);
+  size_t last = limit > numRows - first ? numRows : first + limit;
+  return "?geometry\n" +
+         _rows.substr(_offsets[first], _offsets[last] - _offsets[first]);
+}
+
+// _____________________________________________________________________________
+std::string wktCoords(const DLine& line) {
+  std::string ret;
+  char buf[64];
+  for (const auto& p : line) {
+    snprintf(buf, sizeof(buf), "%s%.7f %.7f", ret.empty() ? "" : ",",
+             p.getX(), p.getY());
+    ret += buf;
+  }
+  return ret;
+}
+
+// _____________________________________________________________________________
+DPoint moveBy(const DPoint& p, double dx, double dy) {
+  // p moved by dx and dy meters
+  return DPoint(p.getX() + dx / (111320 * cos(p.getY() * M_PI / 180)),
+                p.getY() + dy / 110540);
+}
+
+// _____________________________________________________________________________
+std::vector<std::string> mixedRows(size_t n) {
+  // buildings with 4 to 9 vertices, a tenth of them with a hole, and roads
+  // with up to 61 vertices, over an area of about 200 x 200 km
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> u(0, 1);
+  std::vector<std::string> rows;
+
+  for (size_t i = 0; i < n; i++) {
+    DPoint p(7.7 + u(rng) * 2.7, 47.9 + u(rng) * 1.8);
+    size_t kind = rng() % 10;
+
+    if (kind < 5) {
+      size_t num = 4 + rng() % 6;
+      double r = 5 + u(rng) * 15;
+      DLine outer, inner;
+      for (size_t k = 0; k <= num; k++) {
+        double a = k * 2 * M_PI / num;
+        outer.push_back(moveBy(p, r * cos(a), r * sin(a)));
+        inner.push_back(moveBy(p, r / 3 * cos(a), r / 3 * sin(a)));
+      }
+      rows.push_back("POLYGON((" + wktCoords(outer) + ")" +
+                     (kind == 0 ? ",(" + wktCoords(inner) + ")" : "") + ")");
+    } else {
+      size_t num = 2 + rng() % 60;
+      double a = u(rng) * 2 * M_PI;
+      DLine road;
+      for (size_t k = 0; k < num; k++) {
+        road.push_back(p);
+        a += (u(rng) - 0.5) * 0.8;
+        // every fifth road is a long distance one
+        double step = kind == 9 ? 200 + u(rng) * 400 : 5 + u(rng) * 55;
+        p = moveBy(p, step * cos(a), step * sin(a));
+      }
+      rows.push_back("LINESTRING(" + wktCoords(road) + ")");
+    }
+  }
+
+  return rows;
+}
+
+// _____________________________________________________________________________
+std::vector<std::string> roadRows(size_t n) {
+  // roads of 2 to 40 vertices, with segments of 10 m to 5 km
+  std::mt19937_64 rng(7);
+  std::uniform_real_distribution<double> u(0, 1);
+  std::vector<std::string> rows;
+
+  for (size_t i = 0; i < n; i++) {
+    DPoint p(7.7 + u(rng) * 2.7, 47.9 + u(rng) * 1.8);
+    size_t num = 2 + rng() % 39;
+    double a = u(rng) * 2 * M_PI;
+    DLine road;
+    for (size_t k = 0; k < num; k++) {
+      road.push_back(p);
+      a += (u(rng) - 0.5) * 0.6;
+      double step = 10 * pow(500, u(rng));
+      p = moveBy(p, step * cos(a), step * sin(a));
+    }
+    rows.push_back("LINESTRING(" + wktCoords(road) + ")");
+  }
+
+  return rows;
+}
+
+// _____________________________________________________________________________
+std::vector<std::string> clusterRows(size_t n, std::vector<DPoint>* cities) {
+  // points scattered around 300 cities, every seventh one more widely
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> u(0, 1);
+  std::normal_distribution<double> nd(0, 1);
+  for (size_t i = 0; i < 300; i++) {
+    cities->push_back(DPoint(5 + u(rng) * 10, 47 + u(rng) * 8));
+  }
+
+  std::vector<std::string> rows(n);
+  char buf[64];
+  for (size_t i = 0; i < n; i++) {
+    const auto& c = (*cities)[rng() % cities->size()];
+    double sd = rng() % 7 == 0 ? 0.25 : 0.05;
+    snprintf(buf, sizeof(buf), "POINT(%.7f %.7f)",
+             c.getX() + nd(rng) * sd, c.getY() + nd(rng) * sd * 0.7);
+    rows[i] = buf;
+  }
+
+  return rows;
+}
+
+// _____________________________________________________________________________
+std::vector<ID_TYPE> lineIds(const GeomCache& cache, size_t numRows) {
+  // the ids of the lines of all rows
+  std::vector<IdMapping> ids(numRows);
+  for (size_t i = 0; i < numRows; i++) {
+    ids[i] = IdMapping{static_cast<QLEVER_ID_TYPE>(i + 1),
+                       static_cast<ID_TYPE>(i)};
+  }
+
+  std::vector<std::pair<ID_TYPE, ID_TYPE>> objs;
+  cache.getRelObjects(ids, &objs, 0);
+
+  std::vector<ID_TYPE> ret;
+  for (const auto& o : objs) {
+    if (o.first >= I_OFFSET) ret.push_back(o.first - I_OFFSET);
+  }
+  std::sort(ret.begin(), ret.end());
+  ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+  return ret;
+}
+
+// _____________________________________________________________________________
+template <typename F>
+double bestOf(size_t reps, F f) {
+  // the fastest of reps runs of f, in milliseconds
+  double best = std::numeric_limits<double>::infinity();
+  for (size_t i = 0; i < reps; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+  }
+  return best;
+}
+
+// _____________________________________________________________________________
+DLine parseLineStringAtof(const std::string& a, size_t p) {
+  // the coordinate list parsing before WKT.h, with two util::atof() calls
+  // and a projection per vertex
+  DLine line;
+  auto end = memchr(a.c_str() + p, ')', a.size() - p);
+
+  while (true) {
+    line.push_back(util::geo::latLngToWebMerc(
+        DPoint(util::atof(a.c_str() + p, 10),
+               util::atof(static_cast<const char*>(
+                              memchr(a.c_str() + p, ' ', a.size() - p)) +
+                              1,
+                          10))));
+
+    auto n = memchr(a.c_str() + p, ',', a.size() - p);
+    if (!n || n > end) break;
+    p = static_cast<const char*>(n) - a.c_str() + 1;
+  }
+
+  return line;
+}
+
+// _____________________________________________________________________________
+void benchWkt(size_t n) {
+  std::mt19937 rng(3);
+  std::string wkt = "LINESTRING(";
+  for (size_t i = 0; i < n; i++) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s%.7f %.7f", i ? "," : "",
+             7 + (rng() % 1000000) / 1e6, 48 + (rng() % 1000000) / 1e6);
+    wkt += buf;
+  }
+  wkt += ")";
+
+  const size_t start = strlen("LINESTRING(");
+  DLine a, b;
+
+  double tAtof = bestOf(3, [&] { a = parseLineStringAtof(wkt, start); });
+  double tWkt = bestOf(3, [&] {
+    b.clear();
+    petrimaps::parseCoords(wkt.c_str() + start, wkt.c_str() + wkt.size(), &b);
+    petrimaps::projectCoords(&b);
+  });
+
+  double maxDiff =
+      a.size() == b.size() ? 0 : std::numeric_limits<double>::infinity();
+  for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+    maxDiff = std::max(maxDiff, util::geo::dist(a[i], b[i]));
+  }
+
+  std::cout << std::fixed << std::setprecision(1) << "wkt: " << n
+            << " vertices, util::atof " << tAtof << " ms, parseCoords "
+            << tWkt << " ms, max difference " << std::setprecision(9)
+            << maxDiff << " m\n";
+}
+
+// _____________________________________________________________________________
+void benchRadix(size_t n) {
+  const char* names[] = {"uniform", "clustered", "skewed", "duplicate markers"};
+  std::mt19937_64 rng(1);
+
+  for (size_t dist = 0; dist < 4; dist++) {
+    std::vector<IdMapping> v(n);
+    for (size_t i = 0; i < n; i++) {
+      uint64_t q;
+      if (dist == 0) {
+        // uniform over a large index
+        q = rng() % 2000000000;
+      } else if (dist == 1) {
+        // nearly sorted
+        q = (i / 3) * 7 + rng() % 5;
+      } else if (dist == 2) {
+        q = std::exp((rng() % 1000000) / 1000000.0 * 21);
+      } else {
+        // 1% of the rows without a geometry
+        q = rng() % 100 == 0 ? std::numeric_limits<uint32_t>::max()
+                             : rng() % 50000000;
+      }
+      v[i] = IdMapping{static_cast<QLEVER_ID_TYPE>(q),
+                       static_cast<ID_TYPE>(i)};
+    }
+
+    std::vector<IdMapping> a, b;
+    double tStable = bestOf(1, [&] {
+      a = v;
+      std::stable_sort(a.begin(), a.end());
+    });
+    double tRadix = bestOf(1, [&] {
+      b = v;
+      petrimaps::radixSort(b.data(), b.size(),
+                           std::thread::hardware_concurrency());
+    });
+
+    bool same = memcmp(a.data(), b.data(), n * sizeof(IdMapping)) == 0;
+    std::cout << std::fixed << std::setprecision(0) << "radix: " << n
+              << " qids (" << names[dist] << "), std::stable_sort " << tStable
+              << " ms, radixSort " << tRadix << " ms, identical: " << same
+              << "\n";
+  }
+}
+
+// _____________________________________________________________________________
+void benchLines(size_t n) {
+  BenchBackend backend(mixedRows(n));
+
+  for (bool compress : {false, true}) {
+    GeomCache cache(backend.getUrl(), 4, compress, false);
+    double tFill = bestOf(1, [&] { cache.load("", "bench"); });
+    auto lines = lineIds(cache, n);
+
+    // the bounding boxes and all vertices of all lines
+    size_t vertices = 0;
+    double sum = 0;
+    double tScan = bestOf(3, [&] {
+      vertices = 0;
+      for (auto id : lines) {
+        auto reader = cache.getLineReader(id);
+        sum += reader.getBBox().getLowerLeft().getX();
+        DPoint p;
+        while (reader.next(&p)) {
+          sum += p.getX() + p.getY();
+          vertices++;
+        }
+      }
+    });
+
+    std::cout << std::fixed << std::setprecision(1) << "lines: " << n
+              << " rows, " << (compress ? "compressed" : "plain") << ", "
+              << lines.size() << " lines of " << vertices << " vertices, "
+              << cache.getMemSize() / 1000000.0 << " MB, fill " << tFill
+              << " ms, scan " << tScan << " ms (checksum " << sum << ")\n";
+  }
+}
+
+// _____________________________________________________________________________
+void benchDensify(size_t n) {
+  BenchBackend backend(roadRows(n));
+
+  char dir[] = "/tmp/petrimaps-bench-XXXXXX";
+  if (!mkdtemp(dir)) throw std::runtime_error("Could not create a cache dir");
+
+  GeomCache cache(backend.getUrl(), 4, false, false);
+  double tFill = bestOf(1, [&] { cache.load(dir, "bench"); });
+  auto lines = lineIds(cache, n);
+
+  // the cache file, and the link named after the backend
+  size_t fileSize = 0;
+  DIR* d = opendir(dir);
+  while (dirent* e = readdir(d)) {
+    std::string fname = std::string(dir) + "/" + e->d_name;
+    struct stat st;
+    if (lstat(fname.c_str(), &st) != 0 || S_ISDIR(st.st_mode)) continue;
+    if (S_ISREG(st.st_mode)) fileSize += st.st_size;
+    unlink(fname.c_str());
+  }
+  closedir(d);
+  rmdir(dir);
+
+  // the lines densified at the LINE_POINT_DIST of the Requestor, as they
+  // were stored before, once materialized and densified by
+  // util::geo::densify(), and once densified while they are read
+  size_t vertices = 0;
+  size_t densified = 0;
+  size_t diffs = 0;
+  for (auto id : lines) {
+    DLine line, lazy;
+    auto reader = cache.getLineReader(id);
+    DPoint p;
+    while (reader.next(&p)) line.push_back(p);
+    auto dens = util::geo::densify(line, 600);
+
+    reader = cache.getLineReader(id);
+    reader.densify(600);
+    while (reader.next(&p)) lazy.push_back(p);
+
+    vertices += line.size();
+    densified += dens.size();
+    if (!(dens == lazy)) diffs++;
+  }
+
+  double sum = 0;
+  double tCopy = bestOf(3, [&] {
+    for (auto id : lines) {
+      DLine line;
+      auto reader = cache.getLineReader(id);
+      DPoint p;
+      while (reader.next(&p)) line.push_back(p);
+      for (const auto& q : util::geo::densify(line, 600)) sum += q.getX();
+    }
+  });
+  double tLazy = bestOf(3, [&] {
+    for (auto id : lines) {
+      auto reader = cache.getLineReader(id);
+      reader.densify(600);
+      DPoint p;
+      while (reader.next(&p)) sum += p.getX();
+    }
+  });
+
+  std::cout << std::fixed << std::setprecision(1) << "densify: " << n
+            << " roads, " << vertices << " line points stored, " << densified
+            << " when densified at 600 m, " << diffs
+            << " lines densified differently\n"
+            << "densify: fill " << tFill << " ms, cache file "
+            << fileSize / 1000000.0 << " MB, " << cache.getMemSize() / 1000000.0
+            << " MB in memory\n"
+            << "densify: util::geo::densify() " << tCopy
+            << " ms, LineReader::densify() " << tLazy << " ms (checksum "
+            << sum << ")\n";
+}
+
+// _____________________________________________________________________________
+void benchHilbert(size_t n) {
+  std::vector<DPoint> cities;
+  BenchBackend backend(clusterRows(n, &cities));
+
+  // the rows arrive in WKT string order, which is about the order of the
+  // longitude
+  for (bool hilbert : {false, true}) {
+    GeomCache cache(backend.getUrl(), 4, false, hilbert);
+    double tFill = bestOf(1, [&] { cache.load("", "bench"); });
+
+    std::vector<IdMapping> ids(n);
+    for (size_t i = 0; i < n; i++) {
+      ids[i] = IdMapping{static_cast<QLEVER_ID_TYPE>(i + 1),
+                         static_cast<ID_TYPE>(i)};
+    }
+    std::vector<std::pair<ID_TYPE, ID_TYPE>> objs;
+    cache.getRelObjects(ids, &objs, 0);
+    std::vector<IdMapping>().swap(ids);
+
+    // a point grid of the result, as the Requestor builds it
+    const auto& points = cache.getPoints();
+    FBox bbox;
+    for (const auto& o : objs) {
+      bbox = util::geo::extendBox(points[o.first], bbox);
+    }
+    petrimaps::Grid<ID_TYPE, float> grid(65536, 65536, bbox);
+    for (size_t i = 0; i < objs.size(); i++) grid.add(points[objs[i].first], i);
+    grid.freeze(1);
+
+    // 1000x800 pixel viewports centered at 40 of the cities
+    size_t sum = 0;
+    double tLow = bestOf(3, [&] {
+      // low zoom, 400 m per pixel: count the points of each cell in sub-cells
+      // of 2.5 pixels
+      double vcs = 400 * 2.5;
+      size_t sub = ceil(65536 / vcs);
+      std::vector<uint32_t> subs(sub * sub);
+      for (size_t v = 0; v < 40; v++) {
+        auto c = util::geo::latLngToWebMerc(cities[v]);
+        double w = 1000 * 400 / 2.0, h = 800 * 400 / 2.0;
+        size_t x0 = grid.getCellXFromX(c.getX() - w);
+        size_t x1 = grid.getCellXFromX(c.getX() + w);
+        size_t y0 = grid.getCellYFromY(c.getY() - h);
+        size_t y1 = grid.getCellYFromY(c.getY() + h);
+        for (size_t x = x0; x <= x1 && x < grid.getXWidth(); x++) {
+          for (size_t y = y0; y <= y1 && y < grid.getYHeight(); y++) {
+            auto cell = grid.getCell(x, y);
+            if (cell.empty()) continue;
+            const auto& ll = grid.getBox(x, y).getLowerLeft();
+            std::fill(subs.begin(), subs.end(), 0);
+            for (auto i : cell) {
+              const auto& p = points[objs[i].first];
+              size_t sx = (p.getX() - ll.getX()) / vcs;
+              size_t sy = (p.getY() - ll.getY()) / vcs;
+              if (sx < sub && sy < sub) subs[sx * sub + sy]++;
+            }
+            for (auto s : subs) sum += s;
+          }
+        }
+      }
+    });
+
+    double tHigh = bestOf(3, [&] {
+      // high zoom, 40 m per pixel: look up the points and count them per
+      // pixel
+      std::vector<uint32_t> pixels(1000 * 800);
+      std::vector<ID_TYPE> ret;
+      for (size_t v = 0; v < 40; v++) {
+        auto c = util::geo::latLngToWebMerc(cities[v]);
+        float w = 1000 * 40, h = 800 * 40;
+        FBox box({static_cast<float>(c.getX() - w / 2),
+                  static_cast<float>(c.getY() - h / 2)},
+                 {static_cast<float>(c.getX() + w / 2),
+                  static_cast<float>(c.getY() + h / 2)});
+        const auto& ll = box.getLowerLeft();
+        ret.clear();
+        grid.get(box, &ret);
+        for (auto i : ret) {
+          const auto& p = points[objs[i].first];
+          int px = (p.getX() - ll.getX()) / w * 1000;
+          int py = (p.getY() - ll.getY()) / h * 800;
+          if (px >= 0 && px < 1000 && py >= 0 && py < 800) {
+            pixels[py * 1000 + px]++;
+          }
+        }
+      }
+      for (auto s : pixels) sum += s;
+    });
+
+    std::cout << std::fixed << std::setprecision(1) << "hilbert: " << n
+              << " points, " << (hilbert ? "hilbert order" : "fill order")
+              << ", fill " << tFill << " ms, low zoom " << tLow
+              << " ms, high zoom " << tHigh << " ms (checksum " << sum
+              << ")\n";
+  }
+}
+
+// _____________________________________________________________________________
+int main(int argc, char** argv) {
+  // init CURL
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  std::string bench;
+  size_t n = 0;
+
+  for (int i = 1; i < argc; i++) {
+    std::string cur = argv[i];
+    if (cur == "-h" || cur == "--help") {
+      printHelp(argc, argv);
+      exit(0);
+    } else if (cur == "-n") {
+      if (++i >= argc) {
+        LOG(ERROR) << "Missing argument for input size (-n).";
+        exit(1);
+      }
+      n = atol(argv[i]);
+    } else {
+      bench = cur;
+    }
+  }
+
+  if (bench == "wkt") {
+    benchWkt(n ? n : 2000000);
+  } else if (bench == "radix") {
+    benchRadix(n ? n : 30000000);
+  } else if (bench == "lines") {
+    benchLines(n ? n : 1000000);
+  } else if (bench == "densify") {
+    benchDensify(n ? n : 200000);
+  } else if (bench == "hilbert") {
+    benchHilbert(n ? n : 20000000);
+  } else {
+    LOG(ERROR) << "Unknown benchmark '" << bench << "'.";
+    printHelp(argc, argv);
+    exit(1);
+  }
+}
@@ -5,10 +5,12 @@
 #include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <numeric>
 #include <regex>
 #include <sstream>
 
 #include "qlever-petrimaps/Misc.h"
+#include "qlever-petrimaps/RadixSort.h"
 #include "qlever-petrimaps/server/Requestor.h"
 #include "util/Misc.h"
 #include "util/geo/Geo.h"
@@ -25,6 +27,91 @@ using petrimaps::Requestor;
 using petrimaps::RequestReader;
 using petrimaps::ResObj;
 
+// _____________________________________________________________________________
+static size_t clusterSize(const std::vector<std::pair<ID_TYPE, ID_TYPE>>& objs,
+                          size_t i) {
+  // the number of objects directly following object i which have the same
+  // geometry, but belong to a different row
+  size_t n = 0;
+  while (i + n < objs.size() - 1 && objs[i].first == objs[i + n + 1].first &&
+         objs[i].second != objs[i + n + 1].second) {
+    n++;
+  }
+  return n;
+}
+
+// _____________________________________________________________________________
+static double gridCellSize(double w, double h, size_t n, double minSize) {
+  // a power of two cell size which gives about GRID_CELL_OBJS objects per
+  // cell if the objects were distributed evenly over the w x h area
+  if (n == 0 || w <= 0 || h <= 0) return GRID_MAX_CELL_SIZE;
+  double size = sqrt(w * h * GRID_CELL_OBJS / n);
+  size = pow(2, round(log2(size)));
+  return std::min(GRID_MAX_CELL_SIZE, std::max(minSize, size));
+}
+
+// _____________________________________________________________________________
+static std::vector<size_t> getSlices(
+    const std::vector<std::pair<ID_TYPE, ID_TYPE>>& objs, size_t numThreads,
+    size_t minSlice) {
+  // split objs into one slice per thread for filling partial grids, each
+  // slice with at least minSlice objects. Slices never split objects with
+  // the same geometry, so point clusters stay in one slice.
+  size_t parts = std::max<size_t>(
+      1, std::min(numThreads, objs.size() / std::max<size_t>(1, minSlice)));
+  size_t batch = ceil(static_cast<double>(objs.size()) / parts);
+
+  std::vector<size_t> slices{0};
+  for (size_t t = 1; t < parts; t++) {
+    size_t i = std::max(slices.back(), std::min(batch * t, objs.size()));
+    while (i > 0 && i < objs.size() && objs[i].first == objs[i - 1].first) {
+      i++;
+    }
+    slices.push_back(i);
+  }
+  slices.push_back(objs.size());
+
+  return slices;
+}
+
+// _____________________________________________________________________________
+template <typename V, typename F>
+static void buildGrid(petrimaps::Grid<V, float>* grid,
+                      const std::vector<size_t>& slices, size_t numThreads,
+                      petrimaps::MemoryBudget* memory, F fill) {
+  // fill(g, t) adds the objects of slice t to grid g, the grid is frozen
+  // afterwards
+  if (slices.size() == 2) {
+    fill(grid, 0);
+    grid->freeze(numThreads);
+    return;
+  }
+
+  // the partial grids only hold their non-empty cells
+  std::vector<petrimaps::Grid<V, float>> parts;
+  for (size_t t = 0; t < slices.size() - 1; t++) {
+    parts.emplace_back(grid->getCellWidth(), grid->getCellHeight(),
+                       grid->getBBox(), memory, true);
+  }
+
+  std::exception_ptr ePtr;
+
+  // a failed charge to the session budget aborts the slice
+#pragma omp parallel for num_threads(parts.size()) schedule(static)
+  for (size_t t = 0; t < parts.size(); t++) {
+    try {
+      fill(&parts[t], t);
+    } catch (...) {
+#pragma omp critical
+      { ePtr = std::current_exception(); }
+    }
+  }
+
+  if (ePtr) std::rethrow_exception(ePtr);
+
+  grid->freeze(parts, numThreads);
+}
+
 // _____________________________________________________________________________
 void Requestor::request(const std::string& qry) {
   std::lock_guard<std::mutex> guard(_m);
@@ -40,10 +127,20 @@ void Requestor::request(const std::string& qry) {
 
   _query = qry;
   _ready = false;
-  _objects.clear();
-  _clusterObjects.clear();
-
-  RequestReader reader(_cache->getBackendURL(), _maxMemory);
+  _objects = {};
+  _clusterObjects = {};
+  _pgrid = {};
+  _lgrid = {};
+  _lpgrid = {};
+  _ppyramid = {};
+  _lppyramid = {};
+
+  // the readers of concurrent row requests charge the same budget
+  _memory.release(_objectBytes + _clusterBytes);
+  _objectBytes = 0;
+  _clusterBytes = 0;
+
+  RequestReader reader(_backendUrl, &_memory);
   _query = qry;
 
   LOG(INFO) << "[REQUESTOR] Requesting IDs for query " << qry;
@@ -56,15 +153,15 @@ void Requestor::request(const std::string& qry) {
 
   // sort by qlever id
   LOG(INFO) << "[REQUESTOR] Sorting results by qlever ID...";
-  std::sort(reader._ids.begin(), reader._ids.end());
+  radixSort(reader._ids.data(), reader._ids.size(),
+            std::thread::hardware_concurrency());
   LOG(INFO) << "[REQUESTOR] ... done";
 
   LOG(INFO) << "[REQUESTOR] Retrieving geoms from cache...";
 
   // (geom id, result row)
-  const auto& ret = _cache->getRelObjects(reader._ids);
-  _objects = ret.first;
-  _numObjects = ret.second;
+  _numObjects = _cache->getRelObjects(reader._ids, &_objects, &_memory);
+  _objectBytes = _objects.size() * sizeof(_objects[0]);
   LOG(INFO) << "[REQUESTOR] ... done, got " << _objects.size() << " objects.";
 
   LOG(INFO) << "[REQUESTOR] Calculating bounding box of result...";
@@ -73,6 +170,7 @@ void Requestor::request(const std::string& qry) {
 
   std::vector<util::geo::FBox> pointBoxes(NUM_THREADS);
   std::vector<util::geo::DBox> lineBoxes(NUM_THREADS);
+  std::vector<size_t> numPoints(NUM_THREADS, 0);
   std::vector<size_t> numLines(NUM_THREADS, 0);
   util::geo::FBox pointBbox;
   util::geo::DBox lineBbox;
@@ -88,6 +186,7 @@ void Requestor::request(const std::string& qry) {
         auto pId = geomId;
         pointBoxes[t] =
             util::geo::extendBox(_cache->getPoints()[pId], pointBoxes[t]);
+        numPoints[t]++;
       } else if (geomId < std::numeric_limits<ID_TYPE>::max()) {
         auto lId = geomId - I_OFFSET;
 
@@ -124,190 +223,209 @@ void Requestor::request(const std::string& qry) {
   }
   LOG(INFO) << "[REQUESTOR] Building grid...";
 
-  double GRID_SIZE = 65536;
-
   double pw =
       pointBbox.getUpperRight().getX() - pointBbox.getLowerLeft().getX();
   double ph =
       pointBbox.getUpperRight().getY() - pointBbox.getLowerLeft().getY();
 
-  // estimate memory consumption of empty grid
-  double pxWidth = fmax(0, ceil(pw / GRID_SIZE));
-  double pyHeight = fmax(0, ceil(ph / GRID_SIZE));
+  double pGridSize = gridCellSize(
+      pw, ph, std::accumulate(numPoints.begin(), numPoints.end(), size_t(0)),
+      GRID_MIN_CELL_SIZE);
+
+  double pxWidth = fmax(0, ceil(pw / pGridSize));
+  double pyHeight = fmax(0, ceil(ph / pGridSize));
 
   double lw = lineBbox.getUpperRight().getX() - lineBbox.getLowerLeft().getX();
   double lh = lineBbox.getUpperRight().getY() - lineBbox.getLowerLeft().getY();
 
-  // estimate memory consumption of empty grid
-  double lxWidth = fmax(0, ceil(lw / GRID_SIZE));
-  double lyHeight = fmax(0, ceil(lh / GRID_SIZE));
+  double lGridSize = gridCellSize(
+      lw, lh, std::accumulate(numLines.begin(), numLines.end(), size_t(0)),
+      GRID_MIN_LINE_CELL_SIZE);
+
+  double lxWidth = fmax(0, ceil(lw / lGridSize));
+  double lyHeight = fmax(0, ceil(lh / lGridSize));
 
   LOG(INFO) << "[REQUESTOR] (" << pxWidth << "x" << pyHeight
-            << " cell point grid)";
+            << " cell point grid, cell size " << pGridSize << ")";
   LOG(INFO) << "[REQUESTOR] (" << lxWidth << "x" << lyHeight
-            << " cell line grid)";
-
-  checkMem(8 * (pxWidth * pyHeight), _maxMemory);
-  checkMem(8 * (lxWidth * lyHeight), _maxMemory);
-  checkMem(8 * (lxWidth * lyHeight), _maxMemory);
+            << " cell line grid, cell size " << lGridSize << ")";
 
   util::geo::FBox fLineBbox = {
       {lineBbox.getLowerLeft().getX(), lineBbox.getLowerLeft().getY()},
       {lineBbox.getUpperRight().getX(), lineBbox.getUpperRight().getY()}};
 
-  _pgrid = petrimaps::Grid<ID_TYPE, float>(GRID_SIZE, GRID_SIZE, pointBbox);
-  _lgrid = petrimaps::Grid<ID_TYPE, float>(GRID_SIZE, GRID_SIZE, fLineBbox);
+  // the grid cells are charged to the session as they are allocated
+  _pgrid = petrimaps::Grid<ID_TYPE, float>(pGridSize, pGridSize, pointBbox,
+                                           &_memory);
+  _lgrid = petrimaps::Grid<ID_TYPE, float>(lGridSize, lGridSize, fLineBbox,
+                                           &_memory);
   _lpgrid = petrimaps::Grid<util::geo::Point<uint8_t>, float>(
-      GRID_SIZE, GRID_SIZE, fLineBbox);
-
-  std::exception_ptr ePtr;
+      LINE_POINT_GRID_SIZE, LINE_POINT_GRID_SIZE, fLineBbox, &_memory);
 
-#pragma omp parallel sections
-  {
-#pragma omp section
-    {
-      size_t j = _objects.size();
-
-      for (size_t i = 0; i < _objects.size(); i++) {
-        const auto& p = _objects[i];
-        auto geomId = p.first;
-        if (geomId >= I_OFFSET) continue;
-
-        size_t clusterI = 0;
-        // cluster if they have same geometry, don't do for multigeoms
-        while (i < _objects.size() - 1 && geomId == _objects[i + 1].first &&
-               p.second != _objects[i + 1].second) {
-          clusterI++;
-          i++;
-        }
+  // each grid is filled from slices of the objects into one partial grid
+  // per slice in parallel, the partial grids are then merged into a frozen
+  // grid
+  auto pSlices = getSlices(_objects, NUM_THREADS, GRID_MIN_SLICE);
 
-        if (clusterI > 0) {
-          for (size_t m = 0; m < clusterI; m++) {
-            const auto& p = _objects[i - m];
-            auto geomId = p.first;
-            _pgrid.add(_cache->getPoints()[geomId], j);
-            _clusterObjects.push_back({i - m, {m, clusterI}});
-            j++;
-          }
-        } else {
-          _pgrid.add(_cache->getPoints()[geomId], i);
-        }
+  // the clustered points are numbered after the objects, count the clusters
+  // in each slice to get the first number used in the slice
+  std::vector<size_t> clusterOffs(pSlices.size(), 0);
+  std::vector<size_t> maxClusters(pSlices.size(), 0);
 
-        // every 100000 objects, check memory...
-        if (i % 100000 == 0) {
-          try {
-            checkMem(1, _maxMemory);
-          } catch (...) {
-#pragma omp critical
-            { ePtr = std::current_exception(); }
-            break;
-          }
-        }
-      }
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(static)
+  for (size_t t = 0; t < pSlices.size() - 1; t++) {
+    for (size_t i = pSlices[t]; i < pSlices[t + 1]; i++) {
+      if (_objects[i].first >= I_OFFSET) continue;
+      size_t clusterI = clusterSize(_objects, i);
+      clusterOffs[t + 1] += clusterI;
+      maxClusters[t] = std::max(maxClusters[t], clusterI);
+      i += clusterI;
     }
+  }
 
-#pragma omp section
-    {
-      size_t i = 0;
-      for (const auto& l : _objects) {
-        if (l.first >= I_OFFSET &&
-            l.first < std::numeric_limits<ID_TYPE>::max()) {
-          auto geomId = l.first - I_OFFSET;
-          auto box = _cache->getLineBBox(geomId);
-          util::geo::FBox fbox = {
-              {box.getLowerLeft().getX(), box.getLowerLeft().getY()},
-              {box.getUpperRight().getX(), box.getUpperRight().getY()}};
-          _lgrid.add(fbox, i);
-        }
-        i++;
+  for (size_t t = 1; t < clusterOffs.size(); t++) {
+    clusterOffs[t] += clusterOffs[t - 1];
+  }
 
-        // every 100000 objects, check memory...
-        if (i % 100000 == 0) {
-          try {
-            checkMem(1, _maxMemory);
-          } catch (...) {
-#pragma omp critical
-            { ePtr = std::current_exception(); }
-            break;
-          }
+  _maxClusterSize = *std::max_element(maxClusters.begin(), maxClusters.end());
+
+  _clusterBytes =
+      reserveCharged(&_clusterObjects, clusterOffs.back(), &_memory);
+  _clusterObjects.resize(clusterOffs.back());
+
+  buildGrid(&_pgrid, pSlices, NUM_THREADS, &_memory,
+            [&](petrimaps::Grid<ID_TYPE, float>* grid, size_t t) {
+              size_t c = clusterOffs[t];
+              for (size_t i = pSlices[t]; i < pSlices[t + 1]; i++) {
+                auto geomId = _objects[i].first;
+                if (geomId >= I_OFFSET) continue;
+
+                // cluster if they have same geometry, don't do for
+                // multigeoms
+                size_t clusterI = clusterSize(_objects, i);
+                i += clusterI;
+
+                if (clusterI > 0) {
+                  for (size_t m = 0; m < clusterI; m++) {
+                    const auto& p = _objects[i - m];
+                    grid->add(_cache->getPoints()[p.first],
+                              _objects.size() + c);
+                    _clusterObjects[c] = {i - m, {m, clusterI}};
+                    c++;
+                  }
+                } else {
+                  grid->add(_cache->getPoints()[geomId], i);
+                }
+              }
+            });
+
+  // split dense cells, clustered points are located at their geometry
+  _pgrid.split(
+      GRID_MAX_CELL,
+      [&](ID_TYPE i, const util::geo::FBox&) {
+        if (i >= _objects.size()) {
+          i = _clusterObjects[i - _objects.size()].first;
         }
-      }
-    }
-
-#pragma omp section
-    {
-      size_t i = 0;
-      for (const auto& l : _objects) {
-        if (l.first >= I_OFFSET &&
-            l.first < std::numeric_limits<ID_TYPE>::max()) {
-          auto geomId = l.first - I_OFFSET;
-
-          size_t start = _cache->getLine(geomId);
-          size_t end = _cache->getLineEnd(geomId);
+        const auto& p = _cache->getPoints()[_objects[i].first];
+        return util::geo::FBox(p, p);
+      },
+      NUM_THREADS);
+
+  auto lSlices = getSlices(_objects, NUM_THREADS, GRID_MIN_SLICE);
+
+  buildGrid(&_lgrid, lSlices, NUM_THREADS, &_memory,
+            [&](petrimaps::Grid<ID_TYPE, float>* grid, size_t t) {
+              for (size_t i = lSlices[t]; i < lSlices[t + 1]; i++) {
+                const auto& l = _objects[i];
+                if (l.first < I_OFFSET ||
+                    l.first == std::numeric_limits<ID_TYPE>::max()) {
+                  continue;
+                }
+                auto box = _cache->getLineBBox(l.first - I_OFFSET);
+                util::geo::FBox fbox = {
+                    {box.getLowerLeft().getX(), box.getLowerLeft().getY()},
+                    {box.getUpperRight().getX(), box.getUpperRight().getY()}};
+                grid->add(fbox, i);
+              }
+            });
+
+  _lgrid.split(
+      GRID_MAX_CELL,
+      [&](ID_TYPE i, const util::geo::FBox&) {
+        auto box = _cache->getLineBBox(_objects[i].first - I_OFFSET);
+        return util::geo::FBox(
+            {box.getLowerLeft().getX(), box.getLowerLeft().getY()},
+            {box.getUpperRight().getX(), box.getUpperRight().getY()});
+      },
+      NUM_THREADS);
+
+  // each line adds many points to the line point grid, so its slices may be
+  // smaller
+  auto lpSlices = getSlices(_objects, NUM_THREADS, LINE_POINT_MIN_SLICE);
+
+  buildGrid(
+      &_lpgrid, lpSlices, NUM_THREADS, &_memory,
+      [&](petrimaps::Grid<util::geo::Point<uint8_t>, float>* grid, size_t t) {
+        for (size_t i = lpSlices[t]; i < lpSlices[t + 1]; i++) {
+          const auto& l = _objects[i];
+          if (l.first < I_OFFSET ||
+              l.first == std::numeric_limits<ID_TYPE>::max()) {
+            continue;
+          }
 
-          double mainX = 0;
-          double mainY = 0;
+          auto lr = _cache->getLineReader(l.first - I_OFFSET);
+          lr.densify(LINE_POINT_DIST);
 
-          size_t gi = 0;
+          bool first = true;
 
           uint8_t lastX = 0;
           uint8_t lastY = 0;
 
-          for (size_t li = start; li < end; li++) {
-            const auto& cur = _cache->getLinePoints()[li];
-
-            if (isMCoord(cur.getX())) {
-              mainX = rmCoord(cur.getX());
-              mainY = rmCoord(cur.getY());
-              continue;
-            }
-
-            // skip bounding box at beginning
-            if (++gi < 3) continue;
+          util::geo::DPoint dp;
+          while (lr.next(&dp)) {
+            util::geo::FPoint curP(dp.getX(), dp.getY());
 
-            // extract real geometry
-            util::geo::FPoint curP(
-                (mainX * M_COORD_GRANULARITY + cur.getX()) / 10.0,
-                (mainY * M_COORD_GRANULARITY + cur.getY()) / 10.0);
+            size_t cellX = grid->getCellXFromX(curP.getX());
+            size_t cellY = grid->getCellYFromY(curP.getY());
 
-            size_t cellX = _lpgrid.getCellXFromX(curP.getX());
-            size_t cellY = _lpgrid.getCellYFromY(curP.getY());
+            uint8_t sX = (curP.getX() - grid->getBBox().getLowerLeft().getX() +
+                          cellX * grid->getCellWidth()) /
+                         256;
+            uint8_t sY = (curP.getY() - grid->getBBox().getLowerLeft().getY() +
+                          cellY * grid->getCellHeight()) /
+                         256;
 
-            uint8_t sX =
-                (curP.getX() - _lpgrid.getBBox().getLowerLeft().getX() +
-                 cellX * _lpgrid.getCellWidth()) /
-                256;
-            uint8_t sY =
-                (curP.getY() - _lpgrid.getBBox().getLowerLeft().getY() +
-                 cellY * _lpgrid.getCellHeight()) /
-                256;
-
-            if (gi == 3 || lastX != sX || lastY != sY) {
-              _lpgrid.add(cellX, cellY, {sX, sY});
+            if (first || lastX != sX || lastY != sY) {
+              first = false;
+              grid->add(cellX, cellY, {sX, sY});
               lastX = sX;
               lastY = sY;
             }
           }
         }
-        i++;
+      });
 
-        // every 100000 objects, check memory...
-        if (i % 100000 == 0) {
-          try {
-            checkMem(1, _maxMemory);
-          } catch (...) {
-#pragma omp critical
-            { ePtr = std::current_exception(); }
-            break;
-          }
-        }
-      }
-    }
-  }
+  LOG(INFO) << "[REQUESTOR] ...done";
+  LOG(INFO) << "[REQUESTOR] Building count pyramids...";
 
-  if (ePtr) {
-    std::rethrow_exception(ePtr);
-  }
+  _ppyramid = petrimaps::CountPyramid(
+      _pgrid,
+      [&](ID_TYPE i, const util::geo::FBox&) {
+        if (i >= _objects.size()) {
+          i = _clusterObjects[i - _objects.size()].first;
+        }
+        return _cache->getPoints()[_objects[i].first];
+      },
+      &_memory, NUM_THREADS);
+
+  _lppyramid = petrimaps::CountPyramid(
+      _lpgrid,
+      [](const util::geo::Point<uint8_t>& p, const util::geo::FBox& cellBox) {
+        return util::geo::FPoint(
+            cellBox.getLowerLeft().getX() + p.getX() * 256,
+            cellBox.getLowerLeft().getY() + p.getY() * 256);
+      },
+      &_memory, NUM_THREADS);
 
   _ready = true;
 
@@ -320,7 +438,7 @@ std::vector<std::pair<std::string, std::string>> Requestor::requestRow(
   if (!_cache->ready()) {
     throw std::runtime_error("Geom cache not ready");
   }
-  RequestReader reader(_cache->getBackendURL(), _maxMemory);
+  RequestReader reader(_backendUrl, &_memory);
   LOG(INFO) << "[REQUESTOR] Requesting single row " << row << " for query "
             << _query;
   auto query = prepQueryRow(_query, row);
@@ -342,7 +460,7 @@ void Requestor::requestRows(
   if (!_cache->ready()) {
     throw std::runtime_error("Geom cache not ready");
   }
-  RequestReader reader(_cache->getBackendURL(), _maxMemory);
+  RequestReader reader(_backendUrl, &_memory);
   LOG(INFO) << "[REQUESTOR] Requesting rows for query " << _query;
 
   ReaderCbPair cbPair{&reader, cb};
@@ -354,7 +472,7 @@ void Requestor::requestRows(
         auto pr = static_cast<ReaderCbPair*>(ptr);
         try {
           // clear rows
-          pr->reader->rows = {};
+          pr->reader->clearRows();
           pr->reader->parse(static_cast<const char*>(contents), realsize);
           pr->cb(pr->reader->rows);
         } catch (...) {
@@ -382,7 +500,7 @@ std::string Requestor::prepQuery(std::string query) const {
   if (var == "*") {
     // if we have a wildcard variable (*), we request the list of variables
     // from the backend by sending a LIMIT 0 requests.
-    RequestReader reader(_cache->getBackendURL(), _maxMemory);
+    RequestReader reader(_backendUrl, &_memory);
     auto cols = reader.requestColumns(query + " LIMIT 0");
     if (cols.size() > 0) var = cols.back();
   }
@@ -408,8 +526,8 @@ std::string Requestor::prepQueryRow(std::string query, uint64_t row) const {
 }
 
 // _____________________________________________________________________________
-const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad, double res,
-                                   util::geo::FBox fullbox) const {
+const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad,
+                                   double res) const {
   if (!_cache->ready()) {
     throw std::runtime_error("Geom cache not ready");
   }
@@ -438,10 +556,11 @@ const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad, double res,
 
       std::vector<ID_TYPE> ret;
 
-      if (res > 0)
-        _pgrid.get(fullbox, &ret);
-      else
-        _pgrid.get(fbox, &ret);
+      // clustered points are drawn at most clusterRadius() away from their
+      // position
+      auto pbox = fbox;
+      if (res > 0) pbox = pad(fbox, clusterRadius(_maxClusterSize, res));
+      _pgrid.get(pbox, &ret);
 
 #pragma omp parallel for num_threads(NUM_THREADS) schedule(static)
       for (size_t idx = 0; idx < ret.size(); idx++) {
@@ -474,11 +593,8 @@ const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad, double res,
 #pragma omp parallel for num_threads(NUM_THREADS) schedule(static)
       for (size_t idx = 0; idx < retL.size(); idx++) {
         const auto& i = retL[idx];
-        auto lBox = _cache->getLineBBox(_objects[i].first - I_OFFSET);
-        if (!util::geo::intersects(lBox, box)) continue;
-
-        size_t start = _cache->getLine(_objects[i].first - I_OFFSET);
-        size_t end = _cache->getLineEnd(_objects[i].first - I_OFFSET);
+        auto lr = _cache->getLineReader(_objects[i].first - I_OFFSET);
+        if (!util::geo::intersects(lr.getBBox(), box)) continue;
 
         // TODO _____________________ own function
         double d = std::numeric_limits<double>::infinity();
@@ -486,34 +602,12 @@ const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad, double res,
         util::geo::DPoint curPa, curPb;
         int s = 0;
 
-        size_t gi = 0;
-
-        double mainX = 0;
-        double mainY = 0;
-
         bool isArea = Requestor::isArea(_objects[i].first - I_OFFSET);
 
         util::geo::DLine areaBorder;
 
-        for (size_t i = start; i < end; i++) {
-          // extract real geom
-          const auto& cur = _cache->getLinePoints()[i];
-
-          if (isMCoord(cur.getX())) {
-            mainX = rmCoord(cur.getX());
-            mainY = rmCoord(cur.getY());
-            continue;
-          }
-
-          // skip bounding box at beginning
-          gi++;
-          if (gi < 3) continue;
-
-          // extract real geometry
-          util::geo::DPoint curP(
-              (mainX * M_COORD_GRANULARITY + cur.getX()) / 10.0,
-              (mainY * M_COORD_GRANULARITY + cur.getY()) / 10.0);
-
+        util::geo::DPoint curP;
+        while (lr.next(&curP)) {
           if (isArea) areaBorder.push_back(curP);
 
           if (s == 0) {
@@ -537,8 +631,9 @@ const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad, double res,
         }
         // TODO _____________________ own function
 
-        if (isArea) {
-          if (util::geo::contains(rp, util::geo::DPolygon(areaBorder))) {
+        if (isArea && !isHole(_objects[i].first - I_OFFSET)) {
+          if (util::geo::contains(rp, util::geo::DPolygon(areaBorder)) &&
+              !inHoles(i, rp)) {
             // set it to rad/4 - this allows selecting smaller objects
             // inside the polgon
             d = rad / 4;
@@ -588,7 +683,9 @@ const ResObj Requestor::getNearest(util::geo::DPoint rp, double rad, double res,
 
     const auto& dline = extractLineGeom(lineId);
 
-    if (isArea && util::geo::contains(rp, util::geo::DPolygon(dline))) {
+    if (isArea && !isHole(lineId) &&
+        util::geo::contains(rp, util::geo::DPolygon(dline)) &&
+        !inHoles(nearestL, rp)) {
       return {true,  nearestL,
               {frp}, requestRow(_objects[nearestL].second),
               {},    geomPolyGeoms(nearestL, rad / 10)};
@@ -639,43 +736,46 @@ const ResObj Requestor::getGeom(size_t id, double rad) const {
 
 // _____________________________________________________________________________
 util::geo::DLine Requestor::extractLineGeom(size_t lineId) const {
-  util::geo::DLine dline;
-
-  size_t start = _cache->getLine(lineId);
-  size_t end = _cache->getLineEnd(lineId);
-
-  double mainX = 0;
-  double mainY = 0;
-
-  size_t gi = 0;
-
-  for (size_t i = start; i < end; i++) {
-    // extract real geom
-    const auto& cur = _cache->getLinePoints()[i];
+  return extractLineGeom(lineId, 0);
+}
 
-    if (isMCoord(cur.getX())) {
-      mainX = rmCoord(cur.getX());
-      mainY = rmCoord(cur.getY());
-      continue;
-    }
+// _____________________________________________________________________________
+util::geo::DLine Requestor::extractLineGeom(size_t lineId, double eps) const {
+  // the line at the coarsest precomputed level of detail within eps
+  util::geo::DLine dline;
 
-    // skip bounding box at beginning
-    gi++;
-    if (gi < 3) continue;
+  auto lr = _cache->getLineReader(lineId, eps);
 
-    util::geo::DPoint curP((mainX * M_COORD_GRANULARITY + cur.getX()) / 10.0,
-                           (mainY * M_COORD_GRANULARITY + cur.getY()) / 10.0);
-    dline.push_back(curP);
-  }
+  util::geo::DPoint curP;
+  while (lr.next(&curP)) dline.push_back(curP);
 
   return dline;
 }
 
 // _____________________________________________________________________________
 bool Requestor::isArea(size_t lineId) const {
-  size_t end = _cache->getLineEnd(lineId);
+  return _cache->getLineFlags(lineId) & LINE_AREA;
+}
+
+// _____________________________________________________________________________
+bool Requestor::isHole(size_t lineId) const {
+  return _cache->getLineFlags(lineId) & LINE_HOLE;
+}
+
+// _____________________________________________________________________________
+bool Requestor::inHoles(size_t oid, const util::geo::DPoint& p) const {
+  // the holes of a polygon directly follow its outer ring
+  for (size_t i = oid + 1;
+       i < _objects.size() && _objects[i].second == _objects[oid].second; i++) {
+    if (_objects[i].first < I_OFFSET) break;
+    size_t lineId = _objects[i].first - I_OFFSET;
+    if (!isHole(lineId)) break;
+    if (util::geo::contains(p, util::geo::DPolygon(extractLineGeom(lineId)))) {
+      return true;
+    }
+  }
 
-  return isMCoord(_cache->getLinePoints()[end - 1].getX());
+  return false;
 }
 
 // _____________________________________________________________________________
@@ -686,15 +786,15 @@ util::geo::MultiLine<double> Requestor::geomLineGeoms(size_t oid,
   // catch multigeometries
   for (size_t i = oid;
        i < _objects.size() && _objects[i].second == _objects[oid].second; i++) {
-    if (_objects[oid].first < I_OFFSET) continue;
-    const auto& fline = extractLineGeom(_objects[i].first - I_OFFSET);
+    if (_objects[i].first < I_OFFSET) continue;
+    const auto& fline = extractLineGeom(_objects[i].first - I_OFFSET, eps);
     polys.push_back(util::geo::simplify(fline, eps));
   }
 
   for (size_t i = oid - 1;
        i < _objects.size() && _objects[i].second == _objects[oid].second; i--) {
-    if (_objects[oid].first < I_OFFSET) continue;
-    const auto& fline = extractLineGeom(_objects[i].first - I_OFFSET);
+    if (_objects[i].first < I_OFFSET) continue;
+    const auto& fline = extractLineGeom(_objects[i].first - I_OFFSET, eps);
     polys.push_back(util::geo::simplify(fline, eps));
   }
 
@@ -722,13 +822,13 @@ util::geo::MultiPoint<float> Requestor::geomPointGeoms(size_t oid,
   // catch multigeometries
   for (size_t i = oid;
        i < _objects.size() && _objects[i].second == _objects[oid].second; i++) {
-    if (_objects[oid].first >= I_OFFSET) continue;
+    if (_objects[i].first >= I_OFFSET) continue;
     points.push_back(_cache->getPoints()[_objects[i].first]);
   }
 
   for (size_t i = oid - 1;
        i < _objects.size() && _objects[i].second == _objects[oid].second; i--) {
-    if (_objects[oid].first >= I_OFFSET) continue;
+    if (_objects[i].first >= I_OFFSET) continue;
     points.push_back(_cache->getPoints()[_objects[i].first]);
   }
 
@@ -740,24 +840,40 @@ util::geo::MultiPolygon<double> Requestor::geomPolyGeoms(size_t oid,
                                                          double eps) const {
   std::vector<util::geo::DPolygon> polys;
 
-  // catch multigeometries
+  // catch multigeometries, starting at the first ring of the row to keep
+  // holes together with their outer rings
+  while (oid > 0 && _objects[oid - 1].second == _objects[oid].second) oid--;
+
   for (size_t i = oid;
        i < _objects.size() && _objects[i].second == _objects[oid].second; i++) {
-    if (_objects[oid].first < I_OFFSET) continue;
-    const auto& dline = extractLineGeom(_objects[i].first - I_OFFSET);
-    polys.push_back(util::geo::DPolygon(util::geo::simplify(dline, eps)));
-  }
-
-  for (size_t i = oid - 1;
-       i < _objects.size() && _objects[i].second == _objects[oid].second; i--) {
-    if (_objects[oid].first < I_OFFSET) continue;
-    const auto& dline = extractLineGeom(_objects[i].first - I_OFFSET);
-    polys.push_back(util::geo::DPolygon(util::geo::simplify(dline, eps)));
+    if (_objects[i].first < I_OFFSET) continue;
+    size_t lineId = _objects[i].first - I_OFFSET;
+    const auto& dline = extractLineGeom(lineId, eps);
+    if (isHole(lineId) && polys.size()) {
+      polys.back().getInners().push_back(util::geo::simplify(dline, eps));
+    } else {
+      polys.push_back(util::geo::DPolygon(util::geo::simplify(dline, eps)));
+    }
   }
 
   return polys;
 }
 
+// _____________________________________________________________________________
+double Requestor::clusterRadius(size_t tot, double res) {
+  // the largest distance of a point of a cluster of tot points from its
+  // position, see clusterGeom()
+  double a = 25;
+  double b = 6;
+
+  if (tot <= a) return 2 * tot * res;
+
+  int row = ((-a - b / 2.0) + sqrt((a + b / 2.0) * (a + b / 2.0) +
+                                   2.0 * b * (tot - 1 - a + 2))) /
+            b;
+  return (2 * a + row * 13.0) * res;
+}
+
 // _____________________________________________________________________________
 util::geo::FPoint Requestor::clusterGeom(size_t cid, double res) const {
   size_t oid = _clusterObjects[cid].first;
@@ -13,6 +13,7 @@
 #include <string>
 #include <vector>
 
+#include "qlever-petrimaps/CountPyramid.h"
 #include "qlever-petrimaps/GeomCache.h"
 #include "qlever-petrimaps/Grid.h"
 #include "qlever-petrimaps/Misc.h"
@@ -40,10 +41,16 @@ struct ReaderCbPair {
 
 class Requestor {
  public:
-  Requestor() : _maxMemory(-1) {}
-  Requestor(std::shared_ptr<const GeomCache> cache, size_t maxMemory)
-      : _cache(cache),
-        _maxMemory(maxMemory),
+  Requestor() : _memory(-1) {}
+
+  // the memory of the session is charged to a budget below memory, the
+  // cache may be shared with other backends serving the same index, the
+  // rows are always requested from backendUrl
+  Requestor(std::shared_ptr<const GeomCache> cache,
+            const std::string& backendUrl, MemoryBudget* memory)
+      : _backendUrl(backendUrl),
+        _cache(cache),
+        _memory(memory->max(), memory),
         _createdAt(std::chrono::system_clock::now()) {}
 
   void request(const std::string& query);
@@ -65,6 +72,14 @@ class Requestor {
     return _lpgrid;
   }
 
+  // counts of the point grid values and of the line points, for low zoom
+  // heatmaps
+  const petrimaps::CountPyramid& getPointPyramid() const { return _ppyramid; }
+
+  const petrimaps::CountPyramid& getLinePointPyramid() const {
+    return _lppyramid;
+  }
+
   const std::vector<std::pair<ID_TYPE, ID_TYPE>>& getObjects() const {
     return _objects;
   }
@@ -77,19 +92,19 @@ class Requestor {
     return _cache->getPoints()[id];
   }
 
-  size_t getLine(ID_TYPE id) const { return _cache->getLine(id); }
-
-  size_t getLineEnd(ID_TYPE id) const { return _cache->getLineEnd(id); }
+  LineReader getLineReader(ID_TYPE id) const {
+    return _cache->getLineReader(id);
+  }
 
-  const std::vector<util::geo::Point<int16_t>>& getLinePoints() const {
-    return _cache->getLinePoints();
+  LineReader getLineReader(ID_TYPE id, double eps) const {
+    return _cache->getLineReader(id, eps);
   }
 
   util::geo::DBox getLineBBox(ID_TYPE id) const {
     return _cache->getLineBBox(id);
   }
 
-  const ResObj getNearest(util::geo::DPoint p, double rad, double res, util::geo::FBox box) const;
+  const ResObj getNearest(util::geo::DPoint p, double rad, double res) const;
 
   const ResObj getGeom(size_t id, double rad) const;
 
@@ -99,10 +114,18 @@ class Requestor {
   util::geo::MultiPoint<float> geomPointGeoms(size_t oid) const;
 
   util::geo::DLine extractLineGeom(size_t lineId) const;
+  util::geo::DLine extractLineGeom(size_t lineId, double eps) const;
   bool isArea(size_t lineId) const;
+  bool isHole(size_t lineId) const;
+  bool inHoles(size_t oid, const util::geo::DPoint& p) const;
 
   size_t getNumObjects() const { return _numObjects; }
+
+  // the memory currently charged to this session, in bytes
+  size_t getMemoryUsage() const { return _memory.used(); }
+
   util::geo::FPoint clusterGeom(size_t cid, double res) const;
+  static double clusterRadius(size_t tot, double res);
 
   std::chrono::time_point<std::chrono::system_clock> createdAt() const {
     return _createdAt;
@@ -120,7 +143,8 @@ class Requestor {
 
   std::shared_ptr<const GeomCache> _cache;
 
-  size_t _maxMemory;
+  // must outlive everything charged to it below
+  mutable MemoryBudget _memory;
 
   std::string prepQuery(std::string query) const;
   std::string prepQueryRow(std::string query, uint64_t row) const;
@@ -132,11 +156,19 @@ class Requestor {
   std::vector<std::pair<ID_TYPE, ID_TYPE>> _objects;
   std::vector<std::pair<ID_TYPE, std::pair<size_t, size_t>>> _clusterObjects;
   size_t _numObjects = 0;
+  size_t _maxClusterSize = 0;
+
+  // the bytes of _objects and _clusterObjects charged to _memory
+  size_t _objectBytes = 0;
+  size_t _clusterBytes = 0;
 
   petrimaps::Grid<ID_TYPE, float> _pgrid;
   petrimaps::Grid<ID_TYPE, float> _lgrid;
   petrimaps::Grid<util::geo::Point<uint8_t>, float> _lpgrid;
 
+  petrimaps::CountPyramid _ppyramid;
+  petrimaps::CountPyramid _lppyramid;
+
   bool _ready = false;
 
   std::chrono::time_point<std::chrono::system_clock> _createdAt;
@@ -38,7 +38,6 @@
 using petrimaps::Params;
 using petrimaps::Server;
 using util::geo::contains;
-using util::geo::densify;
 using util::geo::DLine;
 using util::geo::DPoint;
 using util::geo::extendBox;
@@ -51,10 +50,14 @@ const static double THRESHOLD = 200;
 static std::atomic<size_t> _curRow;
 
 // _____________________________________________________________________________
-Server::Server(size_t maxMemory, const std::string& cacheDir, int cacheLifetime)
-    : _maxMemory(maxMemory),
+Server::Server(size_t maxMemory, const std::string& cacheDir, int cacheLifetime,
+               size_t fillRequests, bool compressLines, bool hilbertOrder)
+    : _memory(maxMemory),
       _cacheDir(cacheDir),
-      _cacheLifetime(cacheLifetime) {
+      _cacheLifetime(cacheLifetime),
+      _fillRequests(fillRequests),
+      _compressLines(compressLines),
+      _hilbertOrder(hilbertOrder) {
   std::thread t(&Server::clearOldSessions, this);
   t.detach();
 }
@@ -93,6 +96,8 @@ util::http::Answer Server::handle(const util::http::Req& req, int con) const {
       a = handleExportReq(params, con);
     } else if (cmd == "/loadstatus") {
       a = handleLoadStatusReq(params);
+    } else if (cmd == "/ready") {
+      a = handleReadyReq(params);
     } else if (cmd == "/build.js") {
       a = util::http::Answer(
           "200 OK", std::string(build_js, build_js + sizeof build_js /
@@ -191,6 +196,10 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
 
   size_t subCellSize = (size_t)ceil(realCellSize / virtCellSize);
 
+  // the line point grid has its own cell size
+  size_t lpSubCellSize = (size_t)ceil(
+      r->getLinePointGrid().getCellWidth() / virtCellSize);
+
   LOG(INFO) << "[SERVER] Query resolution: " << res;
   LOG(INFO) << "[SERVER] Virt cell size: " << virtCellSize;
   LOG(INFO) << "[SERVER] Num virt cells: " << subCellSize * subCellSize;
@@ -206,42 +215,81 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
   if (intersects(r->getPointGrid().getBBox(), fbbox)) {
     LOG(INFO) << "[SERVER] Looking up display points...";
     if (res < THRESHOLD) {
-      std::vector<ID_TYPE> ret;
+      const auto& objs = r->getObjects();
 
-      // duplicates are not possible with points
-      r->getPointGrid().get(fbbox, &ret);
+      // (sub-)cells not larger than a virtual cell are drawn as one point,
+      // for the objects style only below a pixel and without clusters to
+      // spread out
+      double aggSize = virtCellSize;
+      if (style == OBJECTS) aggSize = r->getClusters().empty() ? res : 0;
 
-      for (size_t j = 0; j < ret.size(); j++) {
-        size_t i = ret[j];
+      // duplicates are not possible with points
+      r->getPointGrid().getCells(fbbox, [&](const FBox& cellBox,
+                                            const ID_TYPE* begin,
+                                            const ID_TYPE* end) {
+        const auto& ll = cellBox.getLowerLeft();
+        if (cellBox.getUpperRight().getX() - ll.getX() <= aggSize) {
+          int px = ((ll.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
+          int py = h - ((ll.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
+          drawPoint(points[0], points2[0], px, py, w, h, style, end - begin);
+          return;
+        }
 
-        const auto& objs = r->getObjects();
+        for (const ID_TYPE* it = begin; it != end; it++) {
+          size_t i = *it;
 
-        if (i >= objs.size() && style == OBJECTS) {
-          size_t cid = i - objs.size();
-          const auto& p = r->getPoint(objs[r->getClusters()[cid].first].first);
+          if (i >= objs.size() && style == OBJECTS) {
+            size_t cid = i - objs.size();
+            const auto& p =
+                r->getPoint(objs[r->getClusters()[cid].first].first);
 
-          if (!contains(p, fbbox)) continue;
+            if (!contains(p, fbbox)) continue;
 
-          const auto& cp = r->clusterGeom(cid, res);
+            const auto& cp = r->clusterGeom(cid, res);
 
-          int px = ((cp.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
-          int py = h - ((cp.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
+            int px = ((cp.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
+            int py =
+                h - ((cp.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
 
-          int ppx = ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
-          int ppy = h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
+            int ppx = ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
+            int ppy =
+                h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
 
-          drawPoint(points[0], points2[0], px, py, w, h, style, 1);
-          drawLine(image.data(), ppx, ppy, px, py, w, h);
-        } else {
-          if (i >= objs.size()) i = r->getClusters()[i - objs.size()].first;
-          const auto& p = r->getPoint(objs[i].first);
-          if (!contains(p, fbbox)) continue;
+            drawPoint(points[0], points2[0], px, py, w, h, style, 1);
+            drawLine(image.data(), ppx, ppy, px, py, w, h);
+          } else {
+            if (i >= objs.size()) i = r->getClusters()[i - objs.size()].first;
+            const auto& p = r->getPoint(objs[i].first);
+            if (!contains(p, fbbox)) continue;
 
-          int px = ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
-          int py = h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
+            int px = ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
+            int py =
+                h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
 
-          drawPoint(points[0], points2[0], px, py, w, h, style, 1);
+            drawPoint(points[0], points2[0], px, py, w, h, style, 1);
+          }
         }
+      });
+    } else if (r->getPointPyramid().getLevel(virtCellSize)) {
+      // the counts of the coarsest pyramid level not coarser than the
+      // virtual cells
+      auto iBox = intersection(r->getPointGrid().getBBox(), fbbox);
+      const auto& level = *r->getPointPyramid().getLevel(virtCellSize);
+      size_t x0 = level.getCellXFromX(iBox.getLowerLeft().getX());
+      size_t x1 = level.getCellXFromX(iBox.getUpperRight().getX());
+
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(static)
+      for (size_t y = level.getCellYFromY(iBox.getLowerLeft().getY());
+           y <= level.getCellYFromY(iBox.getUpperRight().getY()); y++) {
+        level.getRow(y, x0, x1, [&](size_t x, size_t count) {
+          double cx = level.getOrigin().getX() + x * level.getCellSize();
+          double cy = level.getOrigin().getY() + y * level.getCellSize();
+          int px = ((cx - bbox.getLowerLeft().getX()) / mercW) * w;
+          int py = h - ((cy - bbox.getLowerLeft().getY()) / mercH) * h;
+
+          drawPoint(points[omp_get_thread_num()],
+                    points2[omp_get_thread_num()], px, py, w, h, style, count);
+        });
       }
     } else {
       // they intersect, we checked this above
@@ -258,7 +306,7 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
           }
 
           auto cell = grid.getCell(x, y);
-          if (!cell || cell->size() == 0) continue;
+          if (cell.empty()) continue;
           const auto& cellBox = grid.getBox(x, y);
 
           if (subCellSize == 1) {
@@ -274,22 +322,42 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
 
             drawPoint(points[omp_get_thread_num()],
                       points2[omp_get_thread_num()], px, py, w, h, style,
-                      cell->size());
+                      cell.size());
           } else {
-            for (auto i : *cell) {
-              if (i >= r->getObjects().size()) {
-                assert(i - r->getObjects().size() < r->getClusters().size());
-                i = r->getClusters()[i - r->getObjects().size()].first;
+            // the sub-cells of split cells may be small enough to be drawn
+            // as one point
+            grid.getCells(x, y, fbbox, [&](const FBox& subBox,
+                                           const ID_TYPE* begin,
+                                           const ID_TYPE* end) {
+              const auto& ll = subBox.getLowerLeft();
+              if (subBox.getUpperRight().getX() - ll.getX() <= virtCellSize) {
+                int px = ((ll.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
+                int py =
+                    h - ((ll.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
+                drawPoint(points[omp_get_thread_num()],
+                          points2[omp_get_thread_num()], px, py, w, h, style,
+                          end - begin);
+                return;
               }
-              assert(i < r->getObjects().size());
-              const auto& p = r->getPoint(r->getObjects()[i].first);
-
-              int px = ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
-              int py =
-                  h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
-              drawPoint(points[omp_get_thread_num()],
-                        points2[omp_get_thread_num()], px, py, w, h, style, 1);
-            }
+
+              for (const ID_TYPE* it = begin; it != end; it++) {
+                size_t i = *it;
+                if (i >= r->getObjects().size()) {
+                  assert(i - r->getObjects().size() < r->getClusters().size());
+                  i = r->getClusters()[i - r->getObjects().size()].first;
+                }
+                assert(i < r->getObjects().size());
+                const auto& p = r->getPoint(r->getObjects()[i].first);
+
+                int px =
+                    ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
+                int py =
+                    h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
+                drawPoint(points[omp_get_thread_num()],
+                          points2[omp_get_thread_num()], px, py, w, h, style,
+                          1);
+              }
+            });
           }
         }
       }
@@ -312,13 +380,9 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
       for (size_t idx = 0; idx < ret.size(); idx++) {
         if (idx > 0 && ret[idx] == ret[idx - 1]) continue;
         auto lid = r->getObjects()[ret[idx]].first;
-        const auto& lbox = r->getLineBBox(lid - I_OFFSET);
-        if (!intersects(lbox, bbox)) continue;
-
-        size_t gi = 0;
-
-        size_t start = r->getLine(lid - I_OFFSET);
-        size_t end = r->getLineEnd(lid - I_OFFSET);
+        // a level of detail within half a pixel is sufficient
+        auto lr = r->getLineReader(lid - I_OFFSET, res / 2);
+        if (!intersects(lr.getBBox(), bbox)) continue;
 
         // ___________________________________
         bool isects = false;
@@ -326,25 +390,8 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
         DPoint curPa, curPb;
         int s = 0;
 
-        double mainX = 0;
-        double mainY = 0;
-        for (size_t i = start; i < end; i++) {
-          // extract real geom
-          const auto& cur = r->getLinePoints()[i];
-
-          if (isMCoord(cur.getX())) {
-            mainX = rmCoord(cur.getX());
-            mainY = rmCoord(cur.getY());
-            continue;
-          }
-
-          // skip bounding box at beginning
-          gi++;
-          if (gi < 3) continue;
-
-          // extract real geometry
-          const DPoint curP((mainX * M_COORD_GRANULARITY + cur.getX()) / 10.0,
-                            (mainY * M_COORD_GRANULARITY + cur.getY()) / 10.0);
+        DPoint curP;
+        while (lr.next(&curP)) {
           if (s == 0) {
             curPa = curP;
             s++;
@@ -368,9 +415,11 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
 
         // the factor depends on the render thickness of the line, make
         // this configurable!
-        const auto& denseLine = densify(r->extractLineGeom(lid - I_OFFSET), res);
+        auto dr = r->getLineReader(lid - I_OFFSET, res / 2);
+        dr.densify(res);
 
-        for (const auto& p : denseLine) {
+        DPoint p;
+        while (dr.next(&p)) {
           int px = ((p.getX() - bbox.getLowerLeft().getX()) / mercW) * w;
           int py = h - ((p.getY() - bbox.getLowerLeft().getY()) / mercH) * h;
 
@@ -380,6 +429,28 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
           }
         }
       }
+    } else if (r->getLinePointPyramid().getLevel(virtCellSize)) {
+      auto iBox = intersection(r->getLinePointGrid().getBBox(), fbbox);
+      const auto& level = *r->getLinePointPyramid().getLevel(virtCellSize);
+      size_t x0 = level.getCellXFromX(iBox.getLowerLeft().getX());
+      size_t x1 = level.getCellXFromX(iBox.getUpperRight().getX());
+
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(static)
+      for (size_t y = level.getCellYFromY(iBox.getLowerLeft().getY());
+           y <= level.getCellYFromY(iBox.getUpperRight().getY()); y++) {
+        level.getRow(y, x0, x1, [&](size_t x, size_t count) {
+          double cx = level.getOrigin().getX() + x * level.getCellSize();
+          double cy = level.getOrigin().getY() + y * level.getCellSize();
+          int px = ((cx - bbox.getLowerLeft().getX()) / mercW) * w;
+          int py = h - ((cy - bbox.getLowerLeft().getY()) / mercH) * h;
+
+          if (px >= 0 && py >= 0 && px < w && py < h) {
+            if (points2[omp_get_thread_num()][w * py + px] == 0)
+              points[omp_get_thread_num()].push_back(w * py + px);
+            points2[omp_get_thread_num()][py * w + px] += count;
+          }
+        });
+      }
     } else {
       const auto& lpgrid = r->getLinePointGrid();
       auto iBox = intersection(lpgrid.getBBox(), fbbox);
@@ -392,10 +463,10 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
           if (x >= lpgrid.getXWidth() || y >= lpgrid.getYHeight()) continue;
 
           auto cell = lpgrid.getCell(x, y);
-          if (!cell || cell->size() == 0) continue;
+          if (cell.empty()) continue;
           const auto& cellBox = lpgrid.getBox(x, y);
 
-          if (subCellSize == 1) {
+          if (lpSubCellSize == 1) {
             int px =
                 ((cellBox.getLowerLeft().getX() - bbox.getLowerLeft().getX()) /
                  mercW) *
@@ -408,10 +479,10 @@ util::http::Answer Server::handleHeatMapReq(const Params& pars,
             if (px >= 0 && py >= 0 && px < w && py < h) {
               if (points2[omp_get_thread_num()][w * py + px] == 0)
                 points[omp_get_thread_num()].push_back(w * py + px);
-              points2[omp_get_thread_num()][py * w + px] += cell->size();
+              points2[omp_get_thread_num()][py * w + px] += cell.size();
             }
           } else {
-            for (const auto& p : *cell) {
+            for (const auto& p : cell) {
               int px = ((cellBox.getLowerLeft().getX() + p.getX() * 256 -
                          bbox.getLowerLeft().getX()) /
                         mercW) *
@@ -619,14 +690,10 @@ util::http::Answer Server::handlePosReq(const Params& pars) const {
 
   if (box.size() != 4) throw std::invalid_argument("Invalid request.");
 
-  double x1 = std::atof(box[0].c_str());
   double y1 = std::atof(box[1].c_str());
-  double x2 = std::atof(box[2].c_str());
   double y2 = std::atof(box[3].c_str());
   double mercH = fabs(y2 - y1);
 
-  auto fbbox = FBox({x1, y1}, {x2, y2});
-
   int h = atoi(pars.find("height")->second.c_str());
 
   double reso = mercH / h;
@@ -651,7 +718,7 @@ util::http::Answer Server::handlePosReq(const Params& pars) const {
   }
   // as soon as we are ready, the reqor can be read concurrently
 
-  auto res = reqor->getNearest({x, y}, rad, reso, fbbox);
+  auto res = reqor->getNearest({x, y}, rad, reso);
 
   std::stringstream json;
 
@@ -768,7 +835,7 @@ util::http::Answer Server::handleQueryReq(const Params& pars) const {
       reqor = _rs[sessionId];
     } else {
       reqor = std::shared_ptr<Requestor>(
-          new Requestor(_caches[backend], _maxMemory));
+          new Requestor(_caches[backend], backend, &_memory));
 
       sessionId = getSessionId();
 
@@ -798,6 +865,10 @@ util::http::Answer Server::handleQueryReq(const Params& pars) const {
 
   size_t numObjs = reqor->getNumObjects();
 
+  LOG(INFO) << "[SERVER] Session " << sessionId << " uses "
+            << reqor->getMemoryUsage() << " bytes, " << _memory.used()
+            << " of " << _memory.max() << " bytes used in total";
+
   auto ll = bbox.getLowerLeft();
   auto ur = bbox.getUpperRight();
 
@@ -809,7 +880,8 @@ util::http::Answer Server::handleQueryReq(const Params& pars) const {
   std::stringstream json;
   json << std::fixed << "{\"qid\" : \"" << sessionId << "\",\"bounds\":[["
        << llX << "," << llY << "],[" << urX << "," << urY << "]]"
-       << ",\"numobjects\":" << numObjs << "}";
+       << ",\"numobjects\":" << numObjs
+       << ",\"memory\":" << reqor->getMemoryUsage() << "}";
 
   auto answ = util::http::Answer("200 OK", json.str());
   answ.params["Content-Type"] = "application/json; charset=utf-8";
@@ -1210,7 +1282,8 @@ void Server::createCache(const std::string& backend) const {
     if (_caches.count(backend)) {
       cache = _caches[backend];
     } else {
-      cache = std::shared_ptr<GeomCache>(new GeomCache(backend));
+      cache = std::shared_ptr<GeomCache>(new GeomCache(
+          backend, _fillRequests, _compressLines, _hilbertOrder));
       _caches[backend] = cache;
     }
   }
@@ -1218,21 +1291,230 @@ void Server::createCache(const std::string& backend) const {
 
 // _____________________________________________________________________________
 std::string Server::loadCache(const std::string& backend) const {
-  // std::shared_ptr<Requestor> reqor;
-  std::shared_ptr<GeomCache> cache = _caches[backend];
+  std::shared_ptr<GeomCache> cache;
+  {
+    std::lock_guard<std::mutex> guard(_m);
+    cache = _caches[backend];
+  }
 
   try {
-    return cache->load(_cacheDir);
+    // the identity of the geometries the backend serves now, the cache may
+    // be shared with another backend or hold an outdated index
+    auto hash = cache->requestIndexHash(backend);
+    auto id = cache->getIdentity(hash, backend);
+
+    {
+      std::lock_guard<std::mutex> guard(_m);
+      auto it = id.size() ? _cacheIds.find(id) : _cacheIds.end();
+
+      bool shared = cache->getBackendURL() != backend;
+      for (const auto& c : _caches) {
+        if (c.first != backend && c.second == cache) shared = true;
+      }
+
+      if (it != _cacheIds.end() && it->second != cache) {
+        // another backend serves the same index, share its cache
+        LOG(INFO) << "[SERVER] Backend " << backend
+                  << " serves the same index as "
+                  << it->second->getBackendURL() << ", sharing its cache";
+        cache = it->second;
+        _caches[backend] = cache;
+      } else if (it == _cacheIds.end() && shared) {
+        // the index of the backend differs from the geometries of the shared
+        // cache, don't rebuild them underneath the other backends
+        LOG(INFO) << "[SERVER] Backend " << backend
+                  << " no longer serves the index of the cache of "
+                  << cache->getBackendURL() << ", using its own cache";
+        cache = std::shared_ptr<GeomCache>(new GeomCache(
+            backend, _fillRequests, _compressLines, _hilbertOrder));
+        _caches[backend] = cache;
+        if (id.size()) _cacheIds[id] = cache;
+      } else if (it == _cacheIds.end() && id.size()) {
+        unlistCache(cache);
+        _cacheIds[id] = cache;
+      }
+    }
+
+    std::string indexHash;
+    if (cache->getBackendURL() == backend) {
+      if (cache->getIndexHash() != hash) {
+        // the cache is (re)built
+        std::lock_guard<std::mutex> guard(_m);
+        _loadStates[backend] = LOAD_LOADING;
+      }
+      indexHash = cache->load(_cacheDir, hash);
+    } else {
+      // load() would check the index of the other backend, the cache is
+      // only used while it holds the identity of this backend
+      indexHash = cache->getIndexHash();
+      if (indexHash.empty() || cache->getIdentity(indexHash, backend) != id) {
+        // the shared cache failed or changed meanwhile, use an own one
+        LOG(INFO) << "[SERVER] Shared cache of " << backend
+                  << " does not match its index, using its own cache";
+        {
+          std::lock_guard<std::mutex> guard(_m);
+          cache = std::shared_ptr<GeomCache>(new GeomCache(
+              backend, _fillRequests, _compressLines, _hilbertOrder));
+          _caches[backend] = cache;
+          _loadStates[backend] = LOAD_LOADING;
+        }
+        indexHash = cache->load(_cacheDir, hash);
+      }
+    }
+
+    std::lock_guard<std::mutex> guard(_m);
+    _loadStates[backend] = LOAD_READY;
+
+    if (cache->getBackendURL() == backend) {
+      // the index may have changed since the cache was listed
+      unlistCache(cache);
+      auto id = cache->getIdentity(indexHash);
+      if (id.size()) _cacheIds[id] = cache;
+    }
+
+    chargeCaches(cache);
+    return indexHash;
   } catch (...) {
     std::lock_guard<std::mutex> guard(_m);
 
     auto it = _caches.find(backend);
     if (it != _caches.end()) _caches.erase(it);
 
+    // a failed alias leaves the shared cache listed
+    if (cache->getBackendURL() == backend) unlistCache(cache);
+    _loadStates[backend] = LOAD_FAILED;
+    chargeCaches(0);
+
     throw;
   }
 }
 
+// _____________________________________________________________________________
+void Server::chargeCaches(const std::shared_ptr<GeomCache>& cache) const {
+  // the caches are already in memory, they only reduce the sessions' budget.
+  // A refresh may have changed the size of cache.
+  if (cache) {
+    size_t& charged = _cacheMem[cache];
+    size_t size = cache->getMemSize();
+    if (size > charged) _memory.add(size - charged);
+    if (size < charged) _memory.release(charged - size);
+    charged = size;
+  }
+
+  for (auto it = _cacheMem.begin(); it != _cacheMem.end();) {
+    bool used = false;
+    for (const auto& c : _caches) used = used || c.second == it->first;
+
+    if (used) {
+      it++;
+    } else {
+      _memory.release(it->second);
+      it = _cacheMem.erase(it);
+    }
+  }
+}
+
+// _____________________________________________________________________________
+void Server::unlistCache(const std::shared_ptr<GeomCache>& cache) const {
+  for (auto it = _cacheIds.begin(); it != _cacheIds.end();) {
+    if (it->second == cache) {
+      it = _cacheIds.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+// _____________________________________________________________________________
+void Server::preload(const std::vector<std::string>& backends,
+                     size_t numThreads) {
+  {
+    std::lock_guard<std::mutex> guard(_m);
+    for (const auto& backend : backends) {
+      _preloads.push_back(backend);
+      _loadStates[backend] = LOAD_QUEUED;
+    }
+  }
+
+  numThreads = std::min(std::max(numThreads, size_t(1)), backends.size());
+  for (size_t i = 0; i < numThreads; i++) {
+    std::thread t(&Server::preloadWorker, this);
+    t.detach();
+  }
+}
+
+// _____________________________________________________________________________
+void Server::preloadWorker() const {
+  while (true) {
+    std::string backend;
+    {
+      std::lock_guard<std::mutex> guard(_m);
+      if (_nextPreload >= _preloads.size()) return;
+      backend = _preloads[_nextPreload++];
+      _loadStates[backend] = LOAD_LOADING;
+    }
+
+    LOG(INFO) << "[SERVER] Preloading backend " << backend;
+
+    try {
+      createCache(backend);
+      loadCache(backend);
+      LOG(INFO) << "[SERVER] Backend " << backend << " is ready";
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "[SERVER] Could not preload backend " << backend << ": "
+                 << e.what();
+    }
+  }
+}
+
+// _____________________________________________________________________________
+util::http::Answer Server::handleReadyReq(const Params& pars) const {
+  static const char* STATES[] = {"queued", "loading", "ready", "failed"};
+
+  std::string backend;
+  if (pars.count("backend")) backend = pars.find("backend")->second;
+
+  std::stringstream json;
+  bool ready = true;
+
+  {
+    std::lock_guard<std::mutex> guard(_m);
+
+    if (backend.size()) {
+      // a single backend, which may also have been loaded on demand
+      auto it = _loadStates.find(backend);
+      std::string state = "unknown";
+      if (it != _loadStates.end()) {
+        state = STATES[it->second];
+      } else if (_caches.count(backend)) {
+        state = STATES[LOAD_LOADING];
+      }
+      ready = state == STATES[LOAD_READY];
+      json << "{\"ready\": " << (ready ? "true" : "false")
+           << ", \"state\": \"" << state << "\"}";
+    } else {
+      // all backends, ready once all preloaded ones are
+      json << "{\"backends\": {";
+      bool first = true;
+      for (const auto& s : _loadStates) {
+        if (!first) json << ", ";
+        first = false;
+        json << "\"" << util::jsonStringEscape(s.first) << "\": \""
+             << STATES[s.second] << "\"";
+      }
+      for (const auto& b : _preloads) {
+        if (_loadStates[b] != LOAD_READY) ready = false;
+      }
+      json << "}, \"ready\": " << (ready ? "true" : "false") << "}";
+    }
+  }
+
+  auto answ = util::http::Answer(ready ? "200 OK" : "503 Service Unavailable",
+                                 json.str());
+  answ.params["Content-Type"] = "application/json; charset=utf-8";
+  return answ;
+}
+
 // _____________________________________________________________________________
 void Server::drawLine(unsigned char* image, int x0, int y0, int x1, int y1,
                       int w, int h) const {
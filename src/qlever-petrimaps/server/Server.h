@@ -10,6 +10,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <png.h>
 #include "qlever-petrimaps/GeomCache.h"
@@ -22,14 +23,21 @@ typedef std::map<std::string, std::string> Params;
 
 enum MapStyle { HEATMAP, OBJECTS };
 
+enum LoadState { LOAD_QUEUED, LOAD_LOADING, LOAD_READY, LOAD_FAILED };
+
 class Server : public util::http::Handler {
  public:
   explicit Server(size_t maxMemory, const std::string& cacheDir,
-                  int cacheLifetime);
+                  int cacheLifetime, size_t fillRequests, bool compressLines,
+                  bool hilbertOrder);
 
   virtual util::http::Answer handle(const util::http::Req& request,
                                     int connection) const;
 
+  // load the caches of the given backends in the background, at most
+  // numThreads at a time
+  void preload(const std::vector<std::string>& backends, size_t numThreads);
+
  private:
   static std::string parseUrl(std::string u, std::string pl, Params* params);
 
@@ -42,9 +50,16 @@ class Server : public util::http::Handler {
 
   util::http::Answer handleExportReq(const Params& pars, int sock) const;
   util::http::Answer handleLoadStatusReq(const Params& pars) const;
+  util::http::Answer handleReadyReq(const Params& pars) const;
 
   void createCache(const std::string& backend) const;
   std::string loadCache(const std::string& backend) const;
+  // remove all identities of the cache, _m must be held
+  void unlistCache(const std::shared_ptr<GeomCache>& cache) const;
+  // charge the current size of cache, if given, and release the caches no
+  // backend uses anymore, _m must be held
+  void chargeCaches(const std::shared_ptr<GeomCache>& cache) const;
+  void preloadWorker() const;
 
   void clearSession(const std::string& id) const;
   void clearSessions() const;
@@ -63,20 +78,38 @@ class Server : public util::http::Handler {
   void drawLine(unsigned char* image, int x0, int y0, int x1, int y1, int w,
                 int h) const;
 
-  size_t _maxMemory;
+  // memory of the loaded caches and of all sessions
+  mutable MemoryBudget _memory;
+
+  // the sizes charged for loaded caches
+  mutable std::map<std::shared_ptr<const GeomCache>, size_t> _cacheMem;
 
   std::string _cacheDir;
 
   int _cacheLifetime;
 
+  size_t _fillRequests;
+
+  bool _compressLines;
+
+  bool _hilbertOrder;
+
   // Load Status
   mutable size_t _totalSize = 0;
 
   mutable std::mutex _m;
 
+  // caches by backend URL, backends serving the same index share one cache,
+  // which is also listed under its identity (see GeomCache::getIdentity())
   mutable std::map<std::string, std::shared_ptr<GeomCache>> _caches;
+  mutable std::map<std::string, std::shared_ptr<GeomCache>> _cacheIds;
   mutable std::map<std::string, std::shared_ptr<Requestor>> _rs;
   mutable std::map<std::string, std::string> _queryCache;
+
+  // backends loaded at startup, and the load state of all backends
+  std::vector<std::string> _preloads;
+  mutable size_t _nextPreload = 0;
+  mutable std::map<std::string, LoadState> _loadStates;
 };
 }  // namespace petrimaps
 